@@ -0,0 +1,372 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libnova/julian_day.h"
+
+#include "vnight.h"
+
+/* python extension module that computes a range of nights in-process with
+   libvnight. build libvnight first, see libvnight.c.
+   gcc -shared -fPIC -o _vnight$(python3-config --extension-suffix) _vnight.c $(python3-config --includes) -I/Users/whanlon/local/include -L. -L/Users/whanlon/local/lib/ -lvnight -lnova */
+
+/* order of the events in the returned columns, the same order vnight uses
+   for csv output */
+static const char *event_names[4] = {"sun_set", "sun_rise", "moon_set",
+    "moon_rise"};
+
+static int parse_date(const char *str, unsigned long *year,
+        unsigned long *month, unsigned long *day, double *mjd)
+{
+    int n = 0;
+    if (sscanf(str, "%4lu-%2lu-%2lu%n", year, month, day, &n) != 3 ||
+            n != 10 || str[n] != '\0')
+        return VNIGHT_BAD_DATE;
+
+    return vnight_date_to_mjd(*year, *month, *day, mjd);
+}
+
+/* wrap a bytearray in a memoryview of the given struct format. the
+   memoryview keeps the bytearray alive, so the column is never copied. */
+static PyObject *column_view(PyObject *buffer, const char *format)
+{
+    PyObject *view = PyMemoryView_FromObject(buffer);
+    if (view == NULL)
+        return NULL;
+    PyObject *cast = PyObject_CallMethod(view, "cast", "s", format);
+    Py_DECREF(view);
+    return cast;
+}
+
+/* add a column to the result dictionary, the dictionary takes the
+   reference to the view */
+static int add_column(PyObject *result, const char *name, PyObject *buffer,
+        const char *format)
+{
+    PyObject *view = column_view(buffer, format);
+    if (view == NULL)
+        return -1;
+    int status = PyDict_SetItemString(result, name, view);
+    Py_DECREF(view);
+    return status;
+}
+
+PyDoc_STRVAR(nights_doc,
+"nights(start, stop, roots=False) -> dict\n\
+\n\
+Compute sun and moon events for every UT date from start to stop\n\
+(inclusive, 'YYYY-MM-DD'). Returns a dict of memoryviews, one entry per\n\
+night in each. For each of sun_set, sun_rise, moon_set, and moon_rise\n\
+there are <event>_jd, <event>_illum, and <event>_alt columns of doubles.\n\
+'status' holds the libvnight status code of each night as ints. With\n\
+roots the events are found with the horizon crossing engine, as by\n\
+vnight --roots, instead of libnova's rise/set method.");
+
+static PyObject *vnight_nights(PyObject *self, PyObject *args,
+        PyObject *kwargs)
+{
+    static char *keywords[] = {"start", "stop", "roots", NULL};
+    const char *start;
+    const char *stop;
+    int roots = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss|p:nights", keywords,
+                &start, &stop, &roots))
+        return NULL;
+
+    unsigned long year, month, day;
+    double start_mjd, stop_mjd;
+    if (parse_date(start, &year, &month, &day, &start_mjd) != VNIGHT_OK)
+    {
+        PyErr_Format(PyExc_ValueError, "invalid start date: %s", start);
+        return NULL;
+    }
+    if (parse_date(stop, &year, &month, &day, &stop_mjd) != VNIGHT_OK)
+    {
+        PyErr_Format(PyExc_ValueError, "invalid stop date: %s", stop);
+        return NULL;
+    }
+    if (stop_mjd < start_mjd)
+    {
+        PyErr_SetString(PyExc_ValueError, "stop date is before start date");
+        return NULL;
+    }
+
+    Py_ssize_t n = (Py_ssize_t)(stop_mjd - start_mjd) + 1;
+
+    /* struct of arrays, jd/illum/alt columns for each event plus status */
+    PyObject *buffers[13] = {NULL};
+    double *columns[12];
+    int *status_column;
+    PyObject *result = NULL;
+    for (int i = 0; i < 12; i++)
+    {
+        buffers[i] = PyByteArray_FromStringAndSize(NULL, n * sizeof(double));
+        if (buffers[i] == NULL)
+            goto done;
+        columns[i] = (double *)PyByteArray_AS_STRING(buffers[i]);
+    }
+    buffers[12] = PyByteArray_FromStringAndSize(NULL, n * sizeof(int));
+    if (buffers[12] == NULL)
+        goto done;
+    status_column = (int *)PyByteArray_AS_STRING(buffers[12]);
+
+    /* the crossing engine keeps its track of the sun and moon from one
+       night to the next */
+    struct night_ephemeris eph;
+    init_night_ephemeris(&eph);
+    struct night_track track;
+    init_night_track(&track);
+    eph.track = &track;
+
+    for (Py_ssize_t i = 0; i < n; i++)
+    {
+        /* mjd is at 0h UT, convert back to a calendar date */
+        struct ln_date date;
+        ln_get_date(start_mjd + i + 2400000.5, &date);
+
+        struct ephem_night night;
+        if (roots)
+            get_night_ephem_sites(&eph, &veritas_site, 1, NULL, date.years,
+                    date.months, date.days, &night, &status_column[i]);
+        else
+            status_column[i] = get_night_ephem(date.years, date.months,
+                    date.days, &night);
+
+        struct ephem_data *events[4] = {&night.sun_set, &night.sun_rise,
+            &night.moon_set, &night.moon_rise};
+        for (int e = 0; e < 4; e++)
+        {
+            columns[3*e][i]     = events[e]->jd;
+            columns[3*e + 1][i] = events[e]->moon_illum;
+            columns[3*e + 2][i] = events[e]->moon_alt;
+        }
+    }
+
+    result = PyDict_New();
+    if (result == NULL)
+        goto done;
+    static const char *suffix[3] = {"jd", "illum", "alt"};
+    for (int e = 0; e < 4; e++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%s_%s", event_names[e], suffix[k]);
+            if (add_column(result, name, buffers[3*e + k], "d") != 0)
+            {
+                Py_CLEAR(result);
+                goto done;
+            }
+        }
+    }
+    if (add_column(result, "status", buffers[12], "i") != 0)
+        Py_CLEAR(result);
+
+done:
+    for (int i = 0; i < 13; i++)
+        Py_XDECREF(buffers[i]);
+    return result;
+}
+
+/* get a C contiguous buffer of doubles from obj */
+static int get_doubles(PyObject *obj, Py_buffer *view, const char *name)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+        return -1;
+    if (view->format == NULL || strcmp(view->format, "d") != 0 ||
+            view->itemsize != sizeof(double))
+    {
+        PyErr_Format(PyExc_TypeError, "%s must be a buffer of doubles", name);
+        PyBuffer_Release(view);
+        return -1;
+    }
+    return 0;
+}
+
+PyDoc_STRVAR(sin_altitudes_doc,
+"sin_altitudes(latitude, ra, dec, lst) -> memoryview\n\
+\n\
+Sine of the altitude of each target at ra, dec (buffers of doubles,\n\
+degrees) seen from latitude at each local sidereal time in lst (a buffer\n\
+of doubles, degrees). Returns a memoryview of len(ra)*len(lst) doubles,\n\
+one row of len(lst) per target. See vnight_sin_altitudes.");
+
+PyDoc_STRVAR(altitudes_doc,
+"altitudes(latitude, ra, dec, lst) -> memoryview\n\
+\n\
+Like sin_altitudes, but the altitudes themselves in degrees.");
+
+static PyObject *altitudes_common(PyObject *args, int sine)
+{
+    double latitude;
+    PyObject *ra_obj, *dec_obj, *lst_obj;
+    if (!PyArg_ParseTuple(args, "dOOO", &latitude, &ra_obj, &dec_obj,
+                &lst_obj))
+        return NULL;
+
+    Py_buffer ra, dec, lst;
+    if (get_doubles(ra_obj, &ra, "ra") != 0)
+        return NULL;
+    if (get_doubles(dec_obj, &dec, "dec") != 0)
+    {
+        PyBuffer_Release(&ra);
+        return NULL;
+    }
+    if (get_doubles(lst_obj, &lst, "lst") != 0)
+    {
+        PyBuffer_Release(&ra);
+        PyBuffer_Release(&dec);
+        return NULL;
+    }
+
+    PyObject *result = NULL;
+    size_t n_targets = ra.len/sizeof(double);
+    size_t n_times = lst.len/sizeof(double);
+    if (dec.len != ra.len)
+    {
+        PyErr_SetString(PyExc_ValueError, "ra and dec differ in length");
+        goto done;
+    }
+
+    PyObject *buffer = PyByteArray_FromStringAndSize(NULL,
+            n_targets*n_times*sizeof(double));
+    if (buffer == NULL)
+        goto done;
+    double *out = (double *)PyByteArray_AS_STRING(buffer);
+
+    /* the kernel only reads its arguments, other threads can run */
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    if (sine)
+        status = vnight_sin_altitudes(latitude, ra.buf, dec.buf, n_targets,
+                lst.buf, n_times, out);
+    else
+        status = vnight_altitudes(latitude, ra.buf, dec.buf, n_targets,
+                lst.buf, n_times, out);
+    Py_END_ALLOW_THREADS
+
+    if (status != VNIGHT_OK)
+        PyErr_NoMemory();
+    else
+        result = column_view(buffer, "d");
+    Py_DECREF(buffer);
+
+done:
+    PyBuffer_Release(&ra);
+    PyBuffer_Release(&dec);
+    PyBuffer_Release(&lst);
+    return result;
+}
+
+static PyObject *vnight_sin_altitudes_py(PyObject *self, PyObject *args)
+{
+    return altitudes_common(args, 1);
+}
+
+static PyObject *vnight_altitudes_py(PyObject *self, PyObject *args)
+{
+    return altitudes_common(args, 0);
+}
+
+PyDoc_STRVAR(time_above_doc,
+"time_above(latitude, ra, dec, lst, weights, elevation) -> memoryview\n\
+\n\
+For each target at ra, dec, the sum of weights[j] over the local sidereal\n\
+times lst[j] at which it is above elevation degrees, as seen from\n\
+latitude. ra, dec, lst, and weights are buffers of doubles, lst and\n\
+weights of the same length. Returns a memoryview of len(ra) doubles. See\n\
+vnight_time_above.");
+
+static PyObject *vnight_time_above_py(PyObject *self, PyObject *args)
+{
+    double latitude, elevation;
+    PyObject *objs[4];
+    if (!PyArg_ParseTuple(args, "dOOOOd", &latitude, &objs[0], &objs[1],
+                &objs[2], &objs[3], &elevation))
+        return NULL;
+
+    static const char *names[4] = {"ra", "dec", "lst", "weights"};
+    Py_buffer views[4];
+    int n_views = 0;
+    PyObject *result = NULL;
+    for (; n_views < 4; n_views++)
+    {
+        if (get_doubles(objs[n_views], &views[n_views], names[n_views]) != 0)
+            goto done;
+    }
+    if (views[0].len != views[1].len || views[2].len != views[3].len)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                "ra and dec, or lst and weights, differ in length");
+        goto done;
+    }
+
+    size_t n_targets = views[0].len/sizeof(double);
+    PyObject *buffer = PyByteArray_FromStringAndSize(NULL,
+            n_targets*sizeof(double));
+    if (buffer == NULL)
+        goto done;
+
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    status = vnight_time_above(latitude, views[0].buf, views[1].buf,
+            n_targets, views[2].buf, views[3].buf,
+            views[2].len/sizeof(double), elevation,
+            (double *)PyByteArray_AS_STRING(buffer));
+    Py_END_ALLOW_THREADS
+
+    if (status != VNIGHT_OK)
+        PyErr_NoMemory();
+    else
+        result = column_view(buffer, "d");
+    Py_DECREF(buffer);
+
+done:
+    for (int i = 0; i < n_views; i++)
+        PyBuffer_Release(&views[i]);
+    return result;
+}
+
+static PyMethodDef vnight_methods[] =
+{
+    {"nights", (PyCFunction)(void (*)(void))vnight_nights,
+        METH_VARARGS | METH_KEYWORDS, nights_doc},
+    {"sin_altitudes", vnight_sin_altitudes_py, METH_VARARGS,
+        sin_altitudes_doc},
+    {"altitudes", vnight_altitudes_py, METH_VARARGS, altitudes_doc},
+    {"time_above", vnight_time_above_py, METH_VARARGS, time_above_doc},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef vnight_module =
+{
+    PyModuleDef_HEAD_INIT,
+    "_vnight",
+    "In-process access to the libvnight VERITAS night ephemeris.",
+    -1,
+    vnight_methods
+};
+
+PyMODINIT_FUNC PyInit__vnight(void)
+{
+    PyObject *m = PyModule_Create(&vnight_module);
+    if (m == NULL)
+        return NULL;
+
+    if (PyModule_AddIntConstant(m, "OK", VNIGHT_OK) != 0 ||
+            PyModule_AddIntConstant(m, "MOON_CIRCUMPOLAR",
+                VNIGHT_MOON_CIRCUMPOLAR) != 0 ||
+            PyModule_AddIntConstant(m, "SUN_CIRCUMPOLAR",
+                VNIGHT_SUN_CIRCUMPOLAR) != 0 ||
+            PyModule_AddIntConstant(m, "BAD_DATE", VNIGHT_BAD_DATE) != 0 ||
+            PyModule_AddStringConstant(m, "ALTITUDE_KERNEL",
+                vnight_altitude_kernel()) != 0)
+    {
+        Py_DECREF(m);
+        return NULL;
+    }
+
+    return m;
+}
@@ -0,0 +1,780 @@
+#include <math.h>
+#include <string.h>
+
+#include "libnova/julian_day.h"
+#include "libnova/lunar.h"
+#include "libnova/rise_set.h"
+#include "libnova/sidereal_time.h"
+#include "libnova/solar.h"
+#include "libnova/transform.h"
+#include "libnova/utility.h"
+
+#include "vnight.h"
+
+/* static and shared library:
+   gcc -c -fPIC libvnight.c vnight_altitude.c vnight_batch.c vnight_cache.c vnight_cheb.c vnight_roots.c vnight_series.c vnight_server.c vnight_site.c vnight_stats.c vnight_table.c -I/Users/whanlon/local/include
+   ar rcs libvnight.a libvnight.o vnight_altitude.o vnight_batch.o vnight_cache.o vnight_cheb.o vnight_roots.o vnight_series.o vnight_server.o vnight_site.o vnight_stats.o vnight_table.o
+   gcc -shared -o libvnight.so libvnight.o vnight_altitude.o vnight_batch.o vnight_cache.o vnight_cheb.o vnight_roots.o vnight_series.o vnight_server.o vnight_site.o vnight_stats.o vnight_table.o -L/Users/whanlon/local/lib/ -lnova -lm
+   add -DVNIGHT_STATS to the first line, and to the build of vnight, for
+   the counters and timers of vnight --stats. */
+
+#define VERITAS_LATITUDE 31.675
+#define VERITAS_LONGITUDE -110.952
+#define VERITAS_HORIZON_BEGIN -16.5
+#define VERITAS_HORIZON_END -15.
+
+const double veritas_latitude   = VERITAS_LATITUDE;
+const double veritas_longitude  = VERITAS_LONGITUDE;
+
+const double horizon_angle_begin = VERITAS_HORIZON_BEGIN;
+const double horizon_angle_end = VERITAS_HORIZON_END;
+
+const struct vnight_site veritas_site =
+{
+    "VERITAS", VERITAS_LATITUDE, VERITAS_LONGITUDE, VERITAS_HORIZON_BEGIN,
+    VERITAS_HORIZON_END, -7*3600
+};
+
+/* libnova's body position callback takes no user data, so the cache of
+   the night being solved is handed to cached_solar_equ_coords here. it is
+   per thread so that libvnight itself keeps no shared mutable state; the
+   lunar theory and nutation in libnova still do, see vnight.c for how
+   ranges are computed in parallel. */
+static __thread struct position_cache *active_sun_cache;
+/* shared positions of the night being solved, NULL if it has none */
+static __thread const struct night_ephemeris *active_ephemeris;
+
+/* gregorian calendar to modified julian date. this is the integer
+   algorithm of slaCaldj, so dates convert exactly as they did when vnight
+   linked against slalib. */
+int vnight_date_to_mjd(unsigned long year, unsigned long month,
+        unsigned long day, double *mjd)
+{
+    static const int month_days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30,
+        31, 30, 31};
+
+    if (month < 1 || month > 12 || day < 1)
+        return VNIGHT_BAD_DATE;
+
+    long y = (long)year;
+    long m = (long)month;
+    int leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if ((long)day > month_days[m - 1] + (m == 2 && leap))
+        return VNIGHT_BAD_DATE;
+
+    *mjd = (double)((1461L*(y - (12L - m)/10L + 4712L))/4L
+            + (306L*((m + 9L)%12L) + 5L)/10L
+            - (3L*((y - (12L - m)/10L + 4900L)/100L))/4L
+            + (long)day - 2399904L);
+
+    return VNIGHT_OK;
+}
+
+/* julian date to gregorian calendar date and time. the day is converted
+   with integer arithmetic, the inverse of vnight_date_to_mjd (days from
+   civil by eras of 400 years), and the time of day is taken from the
+   fraction of the day in seconds at once. dates before the gregorian
+   reform are left to libnova, which gives them in the julian calendar. */
+void vnight_jd_to_date(double jd, struct ln_date *date)
+{
+    if (jd < 2299160.5)
+    {
+        ln_get_date(jd, date);
+        return;
+    }
+
+    double day = floor(jd + 0.5);
+    double seconds = (jd + 0.5 - day)*86400.;
+    double whole = floor(seconds);
+    long z = (long)day + (long)floor(whole/86400.) - 1721120L;
+    long second = (long)whole - 86400L*(long)floor(whole/86400.);
+
+    /* z is days since 0000-03-01 */
+    long era = (z >= 0 ? z : z - 146096L)/146097L;
+    long doe = z - era*146097L;
+    long yoe = (doe - doe/1460L + doe/36524L - doe/146096L)/365L;
+    long doy = doe - (365L*yoe + yoe/4L - yoe/100L);
+    long mp = (5L*doy + 2L)/153L;
+
+    date->days = (int)(doy - (153L*mp + 2L)/5L + 1L);
+    date->months = (int)(mp < 10L ? mp + 3L : mp - 9L);
+    date->years = (int)(yoe + era*400L + (date->months <= 2));
+    date->hours = (int)(second/3600L);
+    date->minutes = (int)(second/60L % 60L);
+    date->seconds = (double)(second % 60L) + (seconds - whole);
+}
+
+const struct ln_date *ephem_data_date(struct ephem_data *data)
+{
+    /* months is 1 to 12 in a date that was made */
+    if (data->date.months == 0)
+        vnight_jd_to_date(data->jd, &(data->date));
+    return &(data->date);
+}
+
+void ephem_data_local_date(struct ephem_data *data, long utc_offset,
+        struct ln_date *local)
+{
+    /* the way ln_date_to_zonedate makes it, from the julian day of the UT
+       date rather than jd, so that local times print the same digits as
+       they always have */
+    ephem_data_date(data);
+    vnight_jd_to_date(ln_get_julian_day(&(data->date)) + utc_offset/86400.,
+            local);
+}
+
+int init_night_context(struct night_context *ctx, unsigned long year,
+        unsigned long month, unsigned long day)
+{
+    return init_night_context_site(ctx, &veritas_site, year, month, day);
+}
+
+int init_night_context_site(struct night_context *ctx,
+        const struct vnight_site *site, unsigned long year,
+        unsigned long month, unsigned long day)
+{
+    int status = vnight_date_to_mjd(year, month, day, &(ctx->mjd));
+    if (status != VNIGHT_OK)
+        return status;
+
+    ctx->year = year;
+    ctx->month = month;
+    ctx->day = day;
+    ctx->jd = ctx->mjd + 2400000;
+
+    /* this is written to mimic how loggen routines determine event times.
+       those routines do not set observer elevation or make correction for
+       refraction. */
+    ctx->site = site;
+    ctx->observer.lat = site->latitude;
+    ctx->observer.lng = site->longitude;
+
+    ctx->sun.n = 0;
+    ctx->sun.next = 0;
+    ctx->ephem = NULL;
+
+    return VNIGHT_OK;
+}
+
+void init_night_ephemeris(struct night_ephemeris *eph)
+{
+    memset(eph, 0, sizeof(*eph));
+}
+
+void update_night_ephemeris(struct night_ephemeris *eph, double mjd)
+{
+    /* same julian date as ctx->jd + 0.5 */
+    double day0 = mjd + 2400000 + 0.5;
+    const struct lunar_cheb *cheb = vnight_get_lunar_cheb();
+    if (eph->valid && eph->day0 == day0 && eph->cheb == cheb)
+        return;
+
+    /* slide forward a day if this is the next date */
+    if (eph->valid && eph->day0 + 1. == day0 && eph->cheb == cheb)
+    {
+        eph->sun[0] = eph->sun[1];
+        eph->sun[1] = eph->sun[2];
+        eph->moon[0] = eph->moon[1];
+        eph->moon[1] = eph->moon[2];
+    }
+    else
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            ln_get_solar_equ_coords(day0 - 1. + i, &(eph->sun[i]));
+            vnight_moon_equ_coords(day0 - 1. + i, &(eph->moon[i]));
+        }
+        VNIGHT_COUNT_N(VNIGHT_STAT_SOLAR_POSITIONS, 2);
+    }
+    ln_get_solar_equ_coords(day0 + 1., &(eph->sun[2]));
+    VNIGHT_COUNT(VNIGHT_STAT_SOLAR_POSITIONS);
+    vnight_moon_equ_coords(day0 + 1., &(eph->moon[2]));
+    eph->sidereal = ln_get_apparent_sidereal_time(day0)*15.;
+    eph->day0 = day0;
+    eph->cheb = cheb;
+    eph->valid = 1;
+}
+
+/* the shared positions of ctx, NULL if it has none for its date or the
+   lunar fit has changed since they were computed */
+static const struct night_ephemeris *context_ephemeris(
+        const struct night_context *ctx)
+{
+    const struct night_ephemeris *eph = ctx->ephem;
+    if (eph == NULL || !eph->valid || eph->day0 != ctx->jd + 0.5 ||
+            eph->cheb != vnight_get_lunar_cheb())
+        return NULL;
+    return eph;
+}
+
+/* position of jd from the shared samples, returns 0 if jd is not one of
+   them */
+static int ephemeris_equ_coords(const struct ln_equ_posn samples[3],
+        double jd, struct ln_equ_posn *posn)
+{
+    const struct night_ephemeris *eph = active_ephemeris;
+    for (int i = 0; i < 3; i++)
+    {
+        if (eph->day0 - 1. + i == jd)
+        {
+            *posn = samples[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void cached_equ_coords(struct position_cache *cache,
+        void (*get_equ_coords)(double, struct ln_equ_posn *), double jd,
+        struct ln_equ_posn *posn)
+{
+    for (int i = 0; i < cache->n; i++)
+    {
+        if (cache->jd[i] == jd)
+        {
+            *posn = cache->posn[i];
+            VNIGHT_COUNT(VNIGHT_STAT_POSITION_HITS);
+            return;
+        }
+    }
+
+    get_equ_coords(jd, posn);
+    VNIGHT_COUNT(VNIGHT_STAT_POSITION_MISSES);
+    VNIGHT_COUNT(VNIGHT_STAT_SOLAR_POSITIONS);
+
+    int i = cache->next;
+    cache->jd[i] = jd;
+    cache->posn[i] = *posn;
+    cache->next = (i + 1) % VNIGHT_POSITION_CACHE_SIZE;
+    if (cache->n < VNIGHT_POSITION_CACHE_SIZE)
+        cache->n++;
+}
+
+static void cached_solar_equ_coords(double jd, struct ln_equ_posn *posn)
+{
+    if (active_ephemeris != NULL &&
+            ephemeris_equ_coords(active_ephemeris->sun, jd, posn))
+    {
+        VNIGHT_COUNT(VNIGHT_STAT_POSITION_HITS);
+        return;
+    }
+    cached_equ_coords(active_sun_cache, ln_get_solar_equ_coords, jd, posn);
+}
+
+static void shared_lunar_equ_coords(double jd, struct ln_equ_posn *posn)
+{
+    if (ephemeris_equ_coords(active_ephemeris->moon, jd, posn))
+        VNIGHT_COUNT(VNIGHT_STAT_POSITION_HITS);
+    else
+    {
+        VNIGHT_COUNT(VNIGHT_STAT_POSITION_MISSES);
+        vnight_moon_equ_coords(jd, posn);
+    }
+}
+
+/* fill in a moon rise or set event at time jd */
+static void set_moon_event(struct ephem_data *data, double jd,
+        const char *label)
+{
+    data->jd = jd;
+    data->date.months = 0;
+    data->moon_illum = vnight_moon_disk(jd);
+    strcpy(data->label, label);
+}
+
+/* fill in a sun rise or set event at time jd */
+static void set_sun_event(struct night_context *ctx, struct ephem_data *data,
+        double jd, const char *label)
+{
+    data->jd = jd;
+    data->date.months = 0;
+    /* is the moon above the horizon when the sun rises or sets? */
+    get_moon_alt_and_illum(jd, &(ctx->observer), &(data->moon_alt),
+            &(data->moon_illum));
+
+    strcpy(data->label, label);
+}
+
+/* moon rise and set with libnova. when a lunar chebyshev fit is active the
+   body solver is handed the fit instead of the full lunar theory, and
+   when the night has shared positions it is handed those. */
+static int solve_lunar_rst(struct night_context *ctx,
+        struct ln_rst_time *lunar_rst)
+{
+    VNIGHT_TIMER_START(VNIGHT_TIME_MOON_RISE_SET);
+    VNIGHT_COUNT(VNIGHT_STAT_RST_SOLVES);
+    int status;
+    active_ephemeris = context_ephemeris(ctx);
+    if (active_ephemeris != NULL)
+        status = ln_get_body_rst_horizon(ctx->jd, &(ctx->observer),
+                shared_lunar_equ_coords, LN_LUNAR_STANDART_HORIZON,
+                lunar_rst);
+    else if (vnight_get_lunar_cheb() != NULL)
+        status = ln_get_body_rst_horizon(ctx->jd, &(ctx->observer),
+                vnight_moon_equ_coords, LN_LUNAR_STANDART_HORIZON, lunar_rst);
+    else
+    {
+        /* libnova evaluates the lunar theory on three days itself */
+        status = ln_get_lunar_rst(ctx->jd, &(ctx->observer), lunar_rst);
+        VNIGHT_COUNT_N(VNIGHT_STAT_LUNAR_POSITIONS, 3);
+    }
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_MOON_RISE_SET);
+
+    /* if status != 0, then moon is circumpolar and remains above or below
+     * the horizon for the entire day */
+    if (status != 0)
+        return VNIGHT_MOON_CIRCUMPOLAR;
+
+    return VNIGHT_OK;
+}
+
+int get_moon_rise_set_ctx(struct night_context *ctx, struct ephem_data *rise,
+        struct ephem_data *set)
+{
+    struct ln_rst_time lunar_rst;
+    int status = solve_lunar_rst(ctx, &lunar_rst);
+    if (status != VNIGHT_OK)
+        return status;
+
+    set_moon_event(rise, lunar_rst.rise, "Moon Rise");
+    set_moon_event(set, lunar_rst.set, "Moon Set");
+
+    return VNIGHT_OK;
+}
+
+int get_moon_rise_set(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_data *rise, struct ephem_data *set)
+{
+    struct night_context ctx;
+    int status = init_night_context(&ctx, year, month, day);
+    if (status != VNIGHT_OK)
+        return status;
+
+    return get_moon_rise_set_ctx(&ctx, rise, set);
+}
+
+static int solve_sun_rise_set(struct night_context *ctx,
+        struct ephem_data *rise, struct ephem_data *set)
+{
+    int status;
+
+    /* multiple calls are required for rise and set times because position
+       below the horizon is different for VERITAS twilight at the beginning
+       and end of observing nights. both calls evaluate the sun at the same
+       dates, so the second one is served from the night's position cache
+       instead of going through ln_get_solar_rst_horizon twice. */
+    struct ln_rst_time solar_rst;
+    active_sun_cache = &(ctx->sun);
+    active_ephemeris = context_ephemeris(ctx);
+    /* compute sun set first */
+    VNIGHT_COUNT(VNIGHT_STAT_RST_SOLVES);
+    status = ln_get_body_rst_horizon(ctx->jd, &(ctx->observer),
+            cached_solar_equ_coords, ctx->site->horizon_begin, &solar_rst);
+    /* if status = 0, success
+       if status = 1 (-1), then sun is circumpolar and remains above (below)
+       the horizon for the entire day */
+    if (status != 0)
+        return VNIGHT_SUN_CIRCUMPOLAR;
+    else
+        set_sun_event(ctx, set, solar_rst.set, "Sun Set");
+
+    /* now compute sun rise */
+    VNIGHT_COUNT(VNIGHT_STAT_RST_SOLVES);
+    status = ln_get_body_rst_horizon(ctx->jd, &(ctx->observer),
+            cached_solar_equ_coords, ctx->site->horizon_end, &solar_rst);
+    /* if status = 0, success
+       if status = 1 (-1), then sun is circumpolar and remains above (below)
+       the horizon for the entire day */
+    if (status != 0)
+        return VNIGHT_SUN_CIRCUMPOLAR;
+    else
+        set_sun_event(ctx, rise, solar_rst.rise, "Sun Rise");
+
+    return VNIGHT_OK;
+}
+
+int get_sun_rise_set_ctx(struct night_context *ctx, struct ephem_data *rise,
+        struct ephem_data *set)
+{
+    VNIGHT_TIMER_START(VNIGHT_TIME_SUN_RISE_SET);
+    int status = solve_sun_rise_set(ctx, rise, set);
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_SUN_RISE_SET);
+    return status;
+}
+
+/* calculates sun rise and set times for UT date specified by year, month, and
+   day. moon_rise data is given to provide moon fraction at sun rise and
+   set times. if the moon is not above the horizon, then fraction is set to
+   -1. */
+int get_sun_rise_set(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_data *rise, struct ephem_data *set)
+{
+    struct night_context ctx;
+    int status = init_night_context(&ctx, year, month, day);
+    if (status != VNIGHT_OK)
+        return status;
+
+    return get_sun_rise_set_ctx(&ctx, rise, set);
+}
+
+void get_moon_alt_and_illum(double jd, struct ln_lnlat_posn *observer,
+        double *alt, double *illum)
+{
+    VNIGHT_TIMER_START(VNIGHT_TIME_MOON_ALT_ILLUM);
+    struct ln_equ_posn equ_posn;
+    vnight_moon_equ_coords(jd, &equ_posn);
+    struct ln_hrz_posn hrz_posn;
+    ln_get_hrz_from_equ(&equ_posn, observer, jd, &hrz_posn);
+
+    *alt = hrz_posn.alt;
+    *illum = vnight_moon_disk(jd);
+
+    if (*alt < 0.)
+        *illum *= -1.;
+
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_MOON_ALT_ILLUM);
+}
+
+int get_night_ephem_ctx(struct night_context *ctx, struct ephem_night *night)
+{
+    /* start from a known state so that events the solvers could not fill
+       in are zero rather than garbage */
+    memset(night, 0, sizeof(*night));
+    strcpy(night->sun_set.label, "Sun Set");
+    strcpy(night->sun_rise.label, "Sun Rise");
+    strcpy(night->moon_set.label, "Moon Set");
+    strcpy(night->moon_rise.label, "Moon Rise");
+
+    int moon_status = get_moon_rise_set_ctx(ctx, &(night->moon_rise),
+            &(night->moon_set));
+    int sun_status = get_sun_rise_set_ctx(ctx, &(night->sun_rise),
+            &(night->sun_set));
+
+    VNIGHT_COUNT(VNIGHT_STAT_NIGHTS);
+    VNIGHT_COUNT_STATUS(moon_status | sun_status);
+    return moon_status | sun_status;
+}
+
+int get_night_ephem(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *night)
+{
+    struct night_context ctx;
+    int status = init_night_context(&ctx, year, month, day);
+    if (status != VNIGHT_OK)
+    {
+        memset(night, 0, sizeof(*night));
+        return status;
+    }
+
+    return get_night_ephem_ctx(&ctx, night);
+}
+
+/* mean length of the lunar and the solar day, in days. a night seeded from
+   only one previous night adds these to its event times. */
+static const double lunar_day_length = 1.0351;
+static const double solar_day_length = 1.;
+
+/* change in event time, in days, below which a seeded solve has converged */
+static const double seq_tolerance = 1e-8;
+static const int seq_max_iterations = 8;
+
+void init_night_sequence(struct night_sequence *seq)
+{
+    memset(seq, 0, sizeof(*seq));
+}
+
+/* three point interpolation, equation 3.3 of Meeus. n is in days from the
+   middle sample, the result is the interpolated value and *rate its
+   derivative per day. */
+static double interpolate3(double n, double y1, double y2, double y3,
+        double *rate)
+{
+    double a = y2 - y1;
+    double b = y3 - y2;
+    double c = b - a;
+    *rate = (a + b)/2. + n*c;
+    return y2 + n/2.*(a + b + n*c);
+}
+
+/* newton iteration on the altitude of a body interpolated from posn, the
+   positions at day0 - 1, day0, and day0 + 1. sidereal is the apparent
+   sidereal time at day0 in degrees. returns 0 and sets *jd if the iteration
+   converges, from seed, to a rising (or setting) crossing of horizon inside
+   the UT day [day0, day0 + 1). */
+static int solve_seeded(double seed, double day0, double sidereal,
+        const struct ln_equ_posn posn[3], struct ln_lnlat_posn *observer,
+        double horizon, int rising, double *jd)
+{
+    /* keep ra continuous where it wraps through 0h */
+    double ra[3] = {posn[0].ra, posn[1].ra, posn[2].ra};
+    for (int i = 1; i < 3; i++)
+    {
+        if (ra[i] - ra[i - 1] > 180.)
+            ra[i] -= 360.;
+        else if (ra[i] - ra[i - 1] < -180.)
+            ra[i] += 360.;
+    }
+
+    double lat = ln_deg_to_rad(observer->lat);
+    double sin_h0 = sin(ln_deg_to_rad(horizon));
+    double m = seed - day0;
+    for (int i = 0; i < seq_max_iterations; i++)
+    {
+        VNIGHT_COUNT(VNIGHT_STAT_SEQ_ITERATIONS);
+        double ra_rate, dec_rate;
+        double body_ra = interpolate3(m, ra[0], ra[1], ra[2], &ra_rate);
+        double dec = ln_deg_to_rad(interpolate3(m, posn[0].dec, posn[1].dec,
+                    posn[2].dec, &dec_rate));
+        double ha = ln_deg_to_rad(sidereal + 360.985647*m + observer->lng
+                - body_ra);
+        double ha_rate = ln_deg_to_rad(360.985647 - ra_rate);
+        dec_rate = ln_deg_to_rad(dec_rate);
+
+        /* sine of the altitude and its derivative per day */
+        double f = sin(lat)*sin(dec) + cos(lat)*cos(dec)*cos(ha) - sin_h0;
+        double df = sin(lat)*cos(dec)*dec_rate
+            - cos(lat)*(sin(dec)*cos(ha)*dec_rate + cos(dec)*sin(ha)*ha_rate);
+
+        /* altitude must be increasing for a rise, decreasing for a set */
+        if ((rising && df <= 0.) || (!rising && df >= 0.))
+            return 1;
+
+        double dm = f/df;
+        m -= dm;
+        if (fabs(dm) < seq_tolerance)
+        {
+            if (m < 0. || m >= 1.)
+                return 1;
+            *jd = day0 + m;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int get_night_ephem_seq(struct night_sequence *seq, struct night_context *ctx,
+        struct ephem_night *night)
+{
+    memset(night, 0, sizeof(*night));
+    strcpy(night->sun_set.label, "Sun Set");
+    strcpy(night->sun_rise.label, "Sun Rise");
+    strcpy(night->moon_set.label, "Moon Set");
+    strcpy(night->moon_rise.label, "Moon Rise");
+
+    /* the UT day libnova solves for when handed ctx->jd */
+    double day0 = ctx->jd + 0.5;
+
+    /* take the positions from the shared ephemeris if there is one. if
+       not, slide them forward one day if this is the next night,
+       otherwise start over */
+    int next = seq->nights > 0 && day0 == seq->day0 + 1.;
+    if (!next)
+        seq->nights = 0;
+    const struct night_ephemeris *eph = context_ephemeris(ctx);
+    double sidereal;
+    if (eph != NULL)
+    {
+        memcpy(seq->sun, eph->sun, sizeof(seq->sun));
+        memcpy(seq->moon, eph->moon, sizeof(seq->moon));
+        sidereal = eph->sidereal;
+    }
+    else
+    {
+        if (next)
+        {
+            seq->sun[0] = seq->sun[1];
+            seq->sun[1] = seq->sun[2];
+            seq->moon[0] = seq->moon[1];
+            seq->moon[1] = seq->moon[2];
+        }
+        else
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                ln_get_solar_equ_coords(day0 - 1. + i, &(seq->sun[i]));
+                vnight_moon_equ_coords(day0 - 1. + i, &(seq->moon[i]));
+            }
+            VNIGHT_COUNT_N(VNIGHT_STAT_SOLAR_POSITIONS, 2);
+        }
+        ln_get_solar_equ_coords(day0 + 1., &(seq->sun[2]));
+        VNIGHT_COUNT(VNIGHT_STAT_SOLAR_POSITIONS);
+        vnight_moon_equ_coords(day0 + 1., &(seq->moon[2]));
+        sidereal = ln_get_apparent_sidereal_time(day0)*15.;
+    }
+    seq->day0 = day0;
+
+    static const int rising[4] = {0, 1, 0, 1};
+    const double horizon[4] = {ctx->site->horizon_begin,
+        ctx->site->horizon_end, LN_LUNAR_STANDART_HORIZON,
+        LN_LUNAR_STANDART_HORIZON};
+    double jd[4];
+    int solved[4] = {0, 0, 0, 0};
+
+    if (seq->nights > 0)
+    {
+        for (int e = 0; e < 4; e++)
+        {
+            double seed;
+            if (seq->nights > 1)
+                seed = 2.*seq->prev[e] - seq->prev2[e];
+            else if (e == VNIGHT_MOON_SET || e == VNIGHT_MOON_RISE)
+                seed = seq->prev[e] + lunar_day_length;
+            else
+                seed = seq->prev[e] + solar_day_length;
+
+            const struct ln_equ_posn *posn = seq->sun;
+            if (e == VNIGHT_MOON_SET || e == VNIGHT_MOON_RISE)
+                posn = seq->moon;
+
+            if (solve_seeded(seed, day0, sidereal, posn, &(ctx->observer),
+                        horizon[e], rising[e], &jd[e]) == 0)
+            {
+                solved[e] = 1;
+                seq->seeded++;
+            }
+        }
+    }
+
+    int status = VNIGHT_OK;
+
+    /* anything the seeded solve did not get goes through the reference
+       solvers */
+    if (!solved[VNIGHT_MOON_SET] || !solved[VNIGHT_MOON_RISE])
+    {
+        struct ln_rst_time lunar_rst;
+        if (solve_lunar_rst(ctx, &lunar_rst) != VNIGHT_OK)
+            status |= VNIGHT_MOON_CIRCUMPOLAR;
+        else
+        {
+            for (int e = VNIGHT_MOON_SET; e <= VNIGHT_MOON_RISE; e++)
+            {
+                if (solved[e])
+                    continue;
+                jd[e] = rising[e] ? lunar_rst.rise : lunar_rst.set;
+                solved[e] = 1;
+                seq->fallbacks++;
+                VNIGHT_COUNT(VNIGHT_STAT_SEQ_FALLBACKS);
+            }
+        }
+    }
+
+    active_sun_cache = &(ctx->sun);
+    active_ephemeris = eph;
+    for (int e = VNIGHT_SUN_SET; e <= VNIGHT_SUN_RISE; e++)
+    {
+        if (solved[e])
+            continue;
+        struct ln_rst_time solar_rst;
+        VNIGHT_COUNT(VNIGHT_STAT_RST_SOLVES);
+        if (ln_get_body_rst_horizon(ctx->jd, &(ctx->observer),
+                    cached_solar_equ_coords, horizon[e], &solar_rst) != 0)
+        {
+            status |= VNIGHT_SUN_CIRCUMPOLAR;
+            break;
+        }
+        jd[e] = rising[e] ? solar_rst.rise : solar_rst.set;
+        solved[e] = 1;
+        seq->fallbacks++;
+        VNIGHT_COUNT(VNIGHT_STAT_SEQ_FALLBACKS);
+    }
+
+    if (solved[VNIGHT_SUN_SET])
+        set_sun_event(ctx, &(night->sun_set), jd[VNIGHT_SUN_SET], "Sun Set");
+    if (solved[VNIGHT_SUN_RISE])
+        set_sun_event(ctx, &(night->sun_rise), jd[VNIGHT_SUN_RISE],
+                "Sun Rise");
+    if (solved[VNIGHT_MOON_SET])
+        set_moon_event(&(night->moon_set), jd[VNIGHT_MOON_SET], "Moon Set");
+    if (solved[VNIGHT_MOON_RISE])
+        set_moon_event(&(night->moon_rise), jd[VNIGHT_MOON_RISE],
+                "Moon Rise");
+
+    VNIGHT_COUNT(VNIGHT_STAT_NIGHTS);
+    VNIGHT_COUNT_STATUS(status);
+
+    /* a night with a missing event is no good as a seed */
+    if (status != VNIGHT_OK)
+    {
+        seq->nights = 0;
+        return status;
+    }
+
+    for (int e = 0; e < 4; e++)
+    {
+        seq->prev2[e] = seq->prev[e];
+        seq->prev[e] = jd[e];
+    }
+    seq->nights++;
+
+    return status;
+}
+
+int get_night_ephem_sites(struct night_ephemeris *eph,
+        const struct vnight_site *sites, int n_sites,
+        struct night_sequence *seqs, unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *nights, int *status)
+{
+    double mjd;
+    int date_status = vnight_date_to_mjd(year, month, day, &mjd);
+    if (date_status != VNIGHT_OK)
+    {
+        for (int k = 0; k < n_sites; k++)
+        {
+            memset(&nights[k], 0, sizeof(nights[k]));
+            status[k] = date_status;
+        }
+        return date_status;
+    }
+
+    /* the track has positions of its own */
+    if (eph->track == NULL)
+        update_night_ephemeris(eph, mjd);
+
+    int all_status = VNIGHT_OK;
+    for (int k = 0; k < n_sites; k++)
+    {
+        struct night_context ctx;
+        init_night_context_site(&ctx, &sites[k], year, month, day);
+        ctx.ephem = eph;
+        if (eph->track != NULL)
+            status[k] = get_night_ephem_roots(eph->track, &ctx, &nights[k],
+                    NULL);
+        else if (seqs == NULL)
+            status[k] = get_night_ephem_ctx(&ctx, &nights[k]);
+        else
+            status[k] = get_night_ephem_seq(&seqs[k], &ctx, &nights[k]);
+        all_status |= status[k];
+    }
+
+    return all_status;
+}
+
+const char *vnight_strerror(int status)
+{
+    switch (status)
+    {
+        case VNIGHT_OK:
+            return "success";
+        case VNIGHT_MOON_CIRCUMPOLAR:
+            return "moon is circumpolar";
+        case VNIGHT_SUN_CIRCUMPOLAR:
+            return "sun is circumpolar";
+        case VNIGHT_MOON_CIRCUMPOLAR | VNIGHT_SUN_CIRCUMPOLAR:
+            return "moon and sun are circumpolar";
+        case VNIGHT_BAD_DATE:
+            return "invalid date";
+        case VNIGHT_FILE_ERROR:
+            return "file could not be read or written";
+        case VNIGHT_NO_MEMORY:
+            return "out of memory";
+        case VNIGHT_OUT_OF_RANGE:
+            return "date outside of table";
+        case VNIGHT_STALE_TABLE:
+            return "table made for a different site or twilight";
+        case VNIGHT_NOT_CACHED:
+            return "night not in cache";
+        default:
+            return "unknown status";
+    }
+}
@@ -0,0 +1,196 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libnova/julian_day.h"
+#include "libnova/lunar.h"
+#include "libnova/solar.h"
+
+#include "vnight.h"
+
+/* per-call cost of the libnova routines and libvnight solvers vnight is
+   built from. one JSON object is printed per line, see vbench.py for the
+   end-to-end runs.
+   build libvnight first, see libvnight.c.
+   gcc -o vbench vbench.c -I/Users/whanlon/local/include -L. -L/Users/whanlon/local/lib/ -lvnight -lnova -lm */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void report(const char *name, long calls, double seconds)
+{
+    printf("{\"benchmark\": \"%s\", \"calls\": %ld, \"seconds\": %.6f, "
+            "\"per_call_us\": %.3f}\n", name, calls, seconds,
+            calls > 0 ? seconds/calls*1e6 : 0.);
+}
+
+/* contexts for the nights from start_mjd, reset before each benchmark so
+   that none of them starts with positions cached by another */
+static void init_contexts(struct night_context *ctx, long nights,
+        double start_mjd)
+{
+    for (long i = 0; i < nights; i++)
+    {
+        struct ln_date date;
+        ln_get_date(start_mjd + i + 2400000.5, &date);
+        init_night_context(&ctx[i], date.years, date.months, date.days);
+    }
+}
+
+/* the benchmarks below only look at results through this, so that the
+   calls are not optimized away */
+static volatile double sink;
+
+int main(int argc, char **argv)
+{
+    unsigned long year = 2020, month = 1, day = 1;
+    long nights = 3650;
+    if (argc > 1 && sscanf(argv[1], "%4lu-%2lu-%2lu", &year, &month,
+                &day) != 3)
+    {
+        fprintf(stderr, "usage: %s [START_DATE [NIGHTS]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 2)
+        nights = strtol(argv[2], NULL, 10);
+
+    double start_mjd;
+    if (vnight_date_to_mjd(year, month, day, &start_mjd) != VNIGHT_OK ||
+            nights < 1)
+    {
+        fprintf(stderr, "%s: Invalid start date or number of nights.\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct night_context *ctx = malloc(nights*sizeof(struct night_context));
+    if (ctx == NULL)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    init_contexts(ctx, nights, start_mjd);
+
+    struct ln_rst_time rst;
+    double t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        ln_get_lunar_rst(ctx[i].jd, &(ctx[i].observer), &rst);
+        sink = rst.rise;
+    }
+    report("ln_get_lunar_rst", nights, now() - t);
+
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        ln_get_solar_rst_horizon(ctx[i].jd, &(ctx[i].observer),
+                horizon_angle_begin, &rst);
+        sink = rst.set;
+    }
+    report("ln_get_solar_rst_horizon", nights, now() - t);
+
+    /* hourly through each night */
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        for (int h = 0; h < 12; h++)
+        {
+            double alt, illum;
+            get_moon_alt_and_illum(ctx[i].jd + 1. + h/24., &(ctx[i].observer),
+                    &alt, &illum);
+            sink = alt;
+        }
+    }
+    report("get_moon_alt_and_illum", nights*12, now() - t);
+
+    struct ephem_night night;
+    init_contexts(ctx, nights, start_mjd);
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        get_night_ephem_ctx(&ctx[i], &night);
+        sink = night.sun_set.jd;
+    }
+    report("get_night_ephem_ctx", nights, now() - t);
+
+    struct night_sequence seq;
+    init_night_sequence(&seq);
+    init_contexts(ctx, nights, start_mjd);
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        get_night_ephem_seq(&seq, &ctx[i], &night);
+        sink = night.sun_set.jd;
+    }
+    report("get_night_ephem_seq", nights, now() - t);
+
+    struct night_track track;
+    init_night_track(&track);
+    init_contexts(ctx, nights, start_mjd);
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        get_night_ephem_roots(&track, &ctx[i], &night, NULL);
+        sink = night.sun_set.jd;
+    }
+    report("get_night_ephem_roots", nights, now() - t);
+
+    /* same margin as vnight -m */
+    struct lunar_cheb cheb;
+    t = now();
+    if (lunar_cheb_build(&cheb, start_mjd + 2400000.5 - 2.,
+                start_mjd + nights + 2400000.5 + 3.) != VNIGHT_OK)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    report("lunar_cheb_build", cheb.nsegments, now() - t);
+
+    vnight_set_lunar_cheb(&cheb);
+    init_contexts(ctx, nights, start_mjd);
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        get_night_ephem_ctx(&ctx[i], &night);
+        sink = night.sun_set.jd;
+    }
+    report("get_night_ephem_ctx_cheb", nights, now() - t);
+    vnight_set_lunar_cheb(NULL);
+    lunar_cheb_free(&cheb);
+
+    /* a catalog of targets every 5 minutes through 12 hours of each
+       night, the values per call are one target at one time */
+    enum {targets = 500, times = 144};
+    double ra[targets], dec[targets], lst[times], weights[times];
+    double time_above[targets];
+    for (int i = 0; i < targets; i++)
+    {
+        ra[i] = i*360./targets;
+        dec[i] = -30. + i*120./targets;
+    }
+    for (int j = 0; j < times; j++)
+        weights[j] = 5./60.;
+    long samples = 0;
+    t = now();
+    for (long i = 0; i < nights; i++)
+    {
+        for (int j = 0; j < times; j++)
+            lst[j] = fmod(100. + i*0.9856 + j*1.2534, 360.);
+        vnight_time_above(veritas_site.latitude, ra, dec, targets, lst,
+                weights, times, 30., time_above);
+        sink = time_above[0];
+        samples += targets*times;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "vnight_time_above_%s",
+            vnight_altitude_kernel());
+    report(name, samples, now() - t);
+
+    free(ctx);
+    exit(EXIT_SUCCESS);
+}
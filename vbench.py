@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+
+"""End-to-end throughput of vnight and vsched.py. Prints one JSON document
+with the nights/second of the vnight single-date and batch paths, the
+per-call results of the vbench program, and vsched.py wall times for runs
+of one or more seasons with each output writer."""
+
+import argparse
+import datetime
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import time
+
+vsched = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'vsched.py')
+
+def wall_time(callArgs, **kwargs):
+    """Run callArgs to completion, returning the elapsed seconds"""
+    start = time.perf_counter()
+    subprocess.run(callArgs, check=True, stdout=subprocess.DEVNULL, **kwargs)
+    return time.perf_counter() - start
+
+def bench_vnight(vnight, start, nights, single_nights, jobs):
+    """nights/second of vnight run once per date and over a range"""
+    results = []
+    dates = [start + datetime.timedelta(days=i) for i in range(single_nights)]
+    seconds = sum(wall_time([vnight, '-c', str(d.year), str(d.month),
+                             str(d.day)]) for d in dates)
+    results.append({'benchmark': 'vnight_single_date', 'nights': len(dates),
+                    'seconds': seconds, 'nights_per_second':
+                    len(dates)/seconds})
+
+    stop = start + datetime.timedelta(days=nights - 1)
+    range_args = ['-c', '--start', start.isoformat(), '--stop',
+                  stop.isoformat()]
+    modes = {'vnight_batch': [], 'vnight_batch_sequential': ['-q'],
+             'vnight_batch_moon_cheb': ['-m'],
+             f'vnight_batch_jobs_{jobs}': ['-j', str(jobs)]}
+    for name, extra in modes.items():
+        seconds = wall_time([vnight] + extra + range_args)
+        results.append({'benchmark': name, 'nights': nights,
+                        'seconds': seconds,
+                        'nights_per_second': nights/seconds})
+    return results
+
+def bench_calls(vbench, start, nights):
+    """per-call costs printed by the vbench program, one object per line"""
+    proc = subprocess.run([vbench, start.isoformat(), str(nights)],
+                          check=True, capture_output=True, text=True)
+    return [json.loads(line) for line in proc.stdout.splitlines()]
+
+def bench_vsched(vnight, first_season, seasons, python):
+    """vsched.py wall time for each number of seasons and output writer.
+    a season runs from September 1 to July 1."""
+    outputs = {'schedule': [], 'ical': ['--ical'], 'wiki': ['--wiki']}
+    # vsched.py computes nights with _vnight when it can import it and with
+    # the vnight program when given --night-program
+    sources = {'program': ['--night-program', vnight], 'default': []}
+    results = []
+    for n in seasons:
+        start = datetime.date(first_season, 9, 1)
+        stop = datetime.date(first_season + n, 7, 1)
+        for source, source_args in sources.items():
+            for output, output_args in outputs.items():
+                seconds = wall_time([python, vsched] + source_args +
+                                    output_args + [start.isoformat(),
+                                                   stop.isoformat()])
+                results.append({'benchmark': 'vsched', 'seasons': n,
+                                'source': source, 'output': output,
+                                'nights': (stop - start).days + 1,
+                                'seconds': seconds})
+    return results
+
+parser = argparse.ArgumentParser(description='Benchmark vnight and vsched.py end to end. Results are printed as JSON.')
+parser.add_argument('--vnight', default='vnight',
+                    help='vnight executable (default: %(default)s)')
+parser.add_argument('--vbench', default='vbench',
+                    help='vbench executable for the per-call costs, skipped if it cannot be found (default: %(default)s)')
+parser.add_argument('--start', default='2020-01-01',
+                    help='First UT date of the vnight runs (default: %(default)s)')
+parser.add_argument('--nights', type=int, default=3650,
+                    help='Nights in the vnight batch and vbench runs (default: %(default)s)')
+parser.add_argument('--single-nights', type=int, default=30,
+                    help='Nights computed with one vnight process each (default: %(default)s)')
+parser.add_argument('--jobs', '-j', type=int, default=os.cpu_count() or 1,
+                    help='Worker processes for the vnight --jobs run (default: %(default)s)')
+parser.add_argument('--seasons', default='1,10,100',
+                    help='Comma separated numbers of seasons to run vsched.py for (default: %(default)s)')
+parser.add_argument('--first-season', type=int, default=2025,
+                    help='Year the first season starts (default: %(default)s)')
+parser.add_argument('--output', '-o', help='File to write the results to')
+args = parser.parse_args()
+
+try:
+    start = datetime.date.fromisoformat(args.start)
+    seasons = [int(n) for n in args.seasons.split(',')]
+except ValueError:
+    print('Invalid --start or --seasons.', file=sys.stderr)
+    sys.exit(1)
+
+vnight = shutil.which(args.vnight)
+if vnight is None:
+    print(f'Cannot find {args.vnight}.', file=sys.stderr)
+    sys.exit(1)
+vbench = shutil.which(args.vbench)
+
+results = bench_vnight(vnight, start, args.nights, args.single_nights,
+                       args.jobs)
+if vbench is not None:
+    results += bench_calls(vbench, start, args.nights)
+results += bench_vsched(vnight, args.first_season, seasons, sys.executable)
+
+report = {'date': datetime.datetime.now(datetime.UTC).isoformat(),
+          'host': platform.node(), 'python': platform.python_version(),
+          'results': results}
+if args.output is not None:
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=1)
+        f.write('\n')
+else:
+    json.dump(report, sys.stdout, indent=1)
+    print()
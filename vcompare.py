@@ -0,0 +1,187 @@
+#!/usr/bin/env python
+
+"""Golden-output corpus for vnight. 'generate' writes the reference CSV
+output of the default solver over a range of years, one gzipped file per
+chunk of years. 'check' reruns vnight with the default solver and each
+fast mode over the same ranges and reports the largest event time error
+in seconds and illumination error per event type, failing when a mode is
+past the tolerances. Both use vcompare_corpus next to this script when no
+other directory is given; no corpus is committed there, generate it with
+the libnova vnight is deployed with first."""
+
+import argparse
+import datetime
+import gzip
+import os
+import shlex
+import subprocess
+import sys
+
+# event order of the vnight csv, three fields each: time, moon
+# illumination, moon altitude
+event_names = ('sun_set', 'sun_rise', 'moon_set', 'moon_rise')
+
+def run_vnight(vnight, extra, start, stop):
+    """CSV lines of vnight over start to stop, UT times"""
+    callArgs = [vnight] + extra + ['-c', '--start', start.isoformat(),
+                                   '--stop', stop.isoformat()]
+    proc = subprocess.run(callArgs, check=True, capture_output=True,
+                          text=True)
+    return proc.stdout.splitlines()
+
+# where generate writes and check reads the corpus by default, see the
+# README there
+default_corpus = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                              'vcompare_corpus')
+
+# reference events this close to 0h UT may be found on the other side of
+# midnight by a fast mode, and then belong to another UT date. they are
+# counted apart instead of against the time tolerance.
+boundary_seconds = 120.
+
+def corpus_files(corpus):
+    """(start, stop, path) of each corpus file, in date order. files are
+    named START_STOP.csv.gz."""
+    files = []
+    for name in sorted(os.listdir(corpus)):
+        if not name.endswith('.csv.gz'):
+            continue
+        base = name[:-len('.csv.gz')]
+        try:
+            start, stop = (datetime.date.fromisoformat(d)
+                           for d in base.split('_'))
+        except ValueError:
+            continue
+        files.append((start, stop, os.path.join(corpus, name)))
+    return files
+
+def generate(args):
+    start = datetime.date.fromisoformat(args.start)
+    stop = datetime.date.fromisoformat(args.stop)
+    os.makedirs(args.corpus, exist_ok=True)
+    while start <= stop:
+        chunk_stop = min(datetime.date(start.year + args.chunk_years, 1, 1) -
+                         datetime.timedelta(days=1), stop)
+        lines = run_vnight(args.vnight, [], start, chunk_stop)
+        path = os.path.join(args.corpus, f'{start.isoformat()}_'
+                            f'{chunk_stop.isoformat()}.csv.gz')
+        # no name or time in the gzip header, so the same output makes
+        # the same file
+        with open(path, 'wb') as f:
+            with gzip.GzipFile('', 'wb', 9, f, mtime=0) as z:
+                z.write(('\n'.join(lines) + '\n').encode())
+        print(f'{path}: {len(lines)} nights')
+        start = chunk_stop + datetime.timedelta(days=1)
+    return 0
+
+def near_midnight(time):
+    """True if a csv event time is within boundary_seconds of 0h UT"""
+    try:
+        t = datetime.datetime.fromisoformat(time)
+    except ValueError:
+        return False
+    seconds = t.hour*3600 + t.minute*60 + t.second + t.microsecond*1e-6
+    return min(seconds, 86400. - seconds) < boundary_seconds
+
+def event_errors(reference, line):
+    """(time error in seconds, illumination error) of each event of a
+    night. events that cannot be compared, like a field that is zero in
+    one output only, count as infinite error."""
+    ref = reference.split(',')
+    out = line.split(',')
+    if len(ref) != 12 or len(out) != 12:
+        return [(float('inf'), float('inf'))]*4
+    errors = []
+    for e in range(4):
+        if ref[3*e] == out[3*e]:
+            dt = 0.
+        else:
+            try:
+                dt = abs((datetime.datetime.fromisoformat(out[3*e]) -
+                          datetime.datetime.fromisoformat(ref[3*e]))
+                         .total_seconds())
+            except ValueError:
+                dt = float('inf')
+        dillum = abs(float(out[3*e + 1]) - float(ref[3*e + 1]))
+        errors.append((dt, dillum))
+    return errors
+
+def check(args):
+    files = corpus_files(args.corpus)
+    if not files:
+        print(f'No corpus files in {args.corpus}, write them with '
+              f'{sys.argv[0]} generate first.', file=sys.stderr)
+        return 1
+
+    failed = False
+    for mode in args.mode:
+        extra = shlex.split(mode)
+        name = mode or 'default'
+        max_dt = [0.]*4
+        max_dillum = [0.]*4
+        boundary = [0]*4
+        nights = 0
+        for start, stop, path in files:
+            with gzip.open(path, 'rt') as f:
+                reference = f.read().splitlines()
+            lines = run_vnight(args.vnight, extra, start, stop)
+            if len(lines) != len(reference):
+                print(f'{name}: {len(lines)} nights for {path}, expected '
+                      f'{len(reference)}')
+                failed = True
+                continue
+            for ref, line in zip(reference, lines):
+                ref_times = ref.split(',')[0::3]
+                for e, (dt, dillum) in enumerate(event_errors(ref, line)):
+                    if dt > args.time_tolerance and \
+                            near_midnight(ref_times[e]):
+                        boundary[e] += 1
+                        dt = 0.
+                    max_dt[e] = max(max_dt[e], dt)
+                    max_dillum[e] = max(max_dillum[e], dillum)
+            nights += len(lines)
+
+        mode_failed = max(max_dt) > args.time_tolerance or \
+            max(max_dillum) > args.illum_tolerance
+        failed = failed or mode_failed
+        print(f'{name}: {nights} nights '
+              f'{"FAIL" if mode_failed else "ok"}')
+        for e, event in enumerate(event_names):
+            print(f'  {event:9s}  max time error {max_dt[e]:10.4f} s  '
+                  f'max illum error {max_dillum[e]:.4f}  '
+                  f'past tolerance at midnight {boundary[e]}')
+    return 1 if failed else 0
+
+parser = argparse.ArgumentParser(description='Generate or check the vnight golden-output corpus.')
+parser.add_argument('--vnight', default='vnight',
+                    help='vnight executable (default: %(default)s)')
+subparsers = parser.add_subparsers(dest='command', required=True)
+
+generate_parser = subparsers.add_parser('generate',
+    help='Write reference output of the default solver.')
+generate_parser.add_argument('corpus', nargs='?', default=default_corpus,
+                             help='Directory to write the corpus to (default: %(default)s)')
+generate_parser.add_argument('--start', default='1990-01-01',
+                             help='First UT date (default: %(default)s)')
+generate_parser.add_argument('--stop', default='2039-12-31',
+                             help='Last UT date (default: %(default)s)')
+generate_parser.add_argument('--chunk-years', type=int, default=10,
+                             help='Years per corpus file (default: %(default)s)')
+generate_parser.set_defaults(func=generate)
+
+check_parser = subparsers.add_parser('check',
+    help='Compare fast modes against the corpus.')
+check_parser.add_argument('corpus', nargs='?', default=default_corpus,
+                          help='Corpus directory (default: %(default)s)')
+check_parser.add_argument('--mode', action='append',
+                          help='vnight options of a mode to check, may be repeated. An empty mode is the default solver, which must reproduce the corpus. (default: the default solver, -q, -m, and -q -m)')
+check_parser.add_argument('--time-tolerance', type=float, default=1.,
+                          help='Largest event time error in seconds (default: %(default)s)')
+check_parser.add_argument('--illum-tolerance', type=float, default=2e-4,
+                          help='Largest moon illumination error (default: %(default)s)')
+check_parser.set_defaults(func=check)
+
+args = parser.parse_args()
+if args.command == 'check' and args.mode is None:
+    args.mode = ['', '-q', '-m', '-q -m']
+sys.exit(args.func(args))
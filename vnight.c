@@ -1,76 +1,228 @@
+#include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
-#include "slalib.h"
 #include "libnova/julian_day.h"
-#include "libnova/lunar.h"
-#include "libnova/solar.h"
-#include "libnova/transform.h"
-#include "libnova/utility.h"
 
-/* gcc -o vnight vnight.c -I/Users/whanlon/starlink/include/star -I/Users/whanlon/local/include -L/Users/whanlon/starlink/lib -L/Users/whanlon/local/lib/ -lc -lsla -lnova */
+#include "vnight.h"
 
-/* latitude and longitude used in software/offline/dqm/cgi-bin/skysurvey/
-   db_scheduler/include/VScheduler.h */
-const double veritas_latitude   = 31.675;
-const double veritas_longitude  = -110.952;
-
-/* angles of sun relative to horizon used to define VERITAS twilight. defined
-   in software/offline/dqm/cgi-bin/skysurvey/db_scheduler/src/printRiseSet.cpp
-*/
-const double horizon_angle_begin = -16.5;
-const double horizon_angle_end = -15.;
+/* build libvnight first, see libvnight.c.
+   gcc -o vnight vnight.c -I/Users/whanlon/local/include -L. -L/Users/whanlon/local/lib/ -lc -lvnight -lnova -lm */
 
 char *pname;
 
+/* sites computed for each date, in the order they are given with --site */
+#define MAX_SITES 16
+struct vnight_site sites[MAX_SITES];
+int n_sites = 0;
+
+/* days between moon series samples, 0 unless --moon-series is given */
+double series_step = 0.;
+
+/* solve with the crossing engine of vnight_roots.c, see --roots */
+int use_roots = 0;
+
+/* print the dark window of each night, see --window */
+int window_mode = 0;
+
+/* print every horizon crossing of each UT day, see --crossings */
+int crossings_mode = 0;
+
+/* write counters and timers to stderr at exit, see --stats. the counts of
+   worker processes are added to worker_stats as they finish. */
+int print_stats = 0;
+struct vnight_stats worker_stats;
+int processes = 1;
+double start_seconds;
+
+/* set by SIGINT and SIGTERM to shut down --serve */
+volatile int stop_server = 0;
+
+/* nights --serve keeps, about 20 years */
+#define DEFAULT_SERVE_NIGHTS 8192
+
+/* --binary records are flushed once this many seconds have passed since
+   the last flush, so a reader gets each night soon after it is computed
+   while nights that come quickly still go out in blocks */
+#define BINARY_FLUSH_SECONDS 0.01
+
 void usage()
 {
     printf("usage: %s YEAR MONTH DAY\n", pname);
-    printf("  -c, --csv   Dump output in CSV format for spreadsheet.\n");
-    printf("  -h, --help  Print this message and exit.\n");
-    printf("  -l, --local Output times in MST timezone.\n");
-    printf("  -z, --zone  Print time zone data in output.\n");
+    printf("       %s --start YYYY-MM-DD --stop YYYY-MM-DD\n", pname);
+    printf("       %s --stdin\n", pname);
+    printf("  -b, --binary      Write a range as a binary night table to stdout,\n");
+    printf("                    one record per night as it is computed.\n");
+    printf("  -c, --csv         Dump output in CSV format for spreadsheet.\n");
+    printf("      --connect SOCKET\n");
+    printf("                    Ask the --serve server at SOCKET for the nights\n");
+    printf("                    of a date, range or stdin instead of computing\n");
+    printf("                    them. The server's solver is used.\n");
+    printf("      --crossings   Print every sun and moon horizon crossing of\n");
+    printf("                    each UT date after its night. In CSV the night\n");
+    printf("                    is followed by the number of crossings and\n");
+    printf("                    each crossing's time and event. Implies\n");
+    printf("                    --roots.\n");
+    printf("  -C, --cache DIR   Take a range from the per-year night tables in\n");
+    printf("                    DIR, computing and adding only the nights\n");
+    printf("                    that are not there yet.\n");
+    printf("      --cache-key   Print the name of the directory in a --cache\n");
+    printf("                    DIR the tables of the site and solver are\n");
+    printf("                    kept in, and exit.\n");
+    printf("  -h, --help        Print this message and exit.\n");
+    printf("  -i, --stdin       Read one YYYY-MM-DD date per line from stdin.\n");
+    printf("  -j, --jobs N      Split a range of nights between N worker\n");
+    printf("                    processes.\n");
+    printf("  -l, --local       Output times in the site's time zone (MST for\n");
+    printf("                    VERITAS).\n");
+    printf("  -m, --moon-cheb   Fit the moon with chebyshev polynomials over the\n");
+    printf("                    date range and use the fit for all moon\n");
+    printf("                    positions and phases.\n");
+    printf("  -g, --moon-series MIN\n");
+    printf("                    Write moon altitude, illumination and distance\n");
+    printf("                    from the sun every MIN minutes from sun set to\n");
+    printf("                    sun rise of each night in a range to stdout,\n");
+    printf("                    in binary, see struct moon_series_header.\n");
+    printf("  -M, --moon-cheb-file FILE\n");
+    printf("                    Like -m, but load the fit from FILE. FILE is\n");
+    printf("                    (re)built if missing or too short for the range.\n");
+    printf("      --moon-cheb-check\n");
+    printf("                    Print the largest error of the fit against the\n");
+    printf("                    full lunar theory and exit.\n");
+    printf("  -q, --sequential  Seed each night from the previous nights in\n");
+    printf("                    range and stdin mode (faster, agrees with\n");
+    printf("                    the default solver to seconds).\n");
+    printf("  -s, --start DATE  First UT date of a range of nights.\n");
+    printf("      --serve SOCKET\n");
+    printf("                    Answer queries for nights on the unix socket\n");
+    printf("                    SOCKET until interrupted, keeping the nights\n");
+    printf("                    it computes, see --connect.\n");
+    printf("      --serve-nights N\n");
+    printf("                    Most nights --serve keeps (default %d).\n",
+            DEFAULT_SERVE_NIGHTS);
+    printf("  -S, --site FILE   Compute for the site in FILE instead of VERITAS.\n");
+    printf("                    Give more than once to compute several sites\n");
+    printf("                    in one pass, each line or block of output is\n");
+    printf("                    then labelled with the site name.\n");
+    printf("  -x, --roots       Find events as the horizon crossings of the\n");
+    printf("                    interpolated sun and moon instead of with the\n");
+    printf("                    libnova rise/set method.\n");
+    printf("  -w, --window      Print each night from its sun set to the next\n");
+    printf("                    sun rise with every moon rise and set in\n");
+    printf("                    between, none, one or two of them. In CSV the\n");
+    printf("                    sun set and sun rise are followed by the number\n");
+    printf("                    of moon events and each event with rise or\n");
+    printf("                    set. Implies --roots.\n");
+    printf("  -t, --table FILE  Write the range to FILE as a binary night\n");
+    printf("                    table instead of printing it.\n");
+    printf("  -e, --stop DATE   Last UT date of a range of nights.\n");
+    printf("      --stats       Write counts of position evaluations, solver\n");
+    printf("                    iterations, cache hits and fallbacks, and the\n");
+    printf("                    time spent solving and printing, to stderr as\n");
+    printf("                    JSON at exit. Needs libvnight and vnight built\n");
+    printf("                    with -DVNIGHT_STATS.\n");
+    printf("  -z, --zone        Print time zone data in output.\n");
     printf("\nYear must be four digits. Date is UT date.\n\n");
     printf("Event times are UT unless -l switch is used.\n");
+    printf("In range and stdin mode one night is printed per date, in the\n");
+    printf("order the dates are given.\n");
 
     return;
 }
 
-/* structure to hold a sun rise, sun set, moon rise, moon set event time.
-   fraction of the moon's disk that is illuminated at the time of the
-   event is also stored. if the moon is below the horizon, moon_illum
-   is < 0.
- */
-struct ephem_data
-{
-    /* if used for a sun event, moon_illum is moon fraction at the
-       time stored here. if the moon is not above the horizon, then
-       fraction is < 0. moon_alt is the altitude of the moon on date. */
-    struct ln_date date;
-    double moon_illum; /* fraction of the moon that is illuminated [0 - 1] */
-    double moon_alt; /* altitude of moon */
-    double jd; /* julian date */
-    char label[16];
-};
-
-int get_moon_rise_set(unsigned long year, unsigned long month,
-        unsigned long day, struct ephem_data *rise, struct ephem_data *set);
-int get_sun_rise_set(unsigned long year, unsigned long month,
-        unsigned long day, struct ephem_data *rise, struct ephem_data *set);
-void get_moon_alt_and_illum(double jd, struct ln_lnlat_posn *observer,
-        double *alt, double *illum);
 void print_ephem_data(struct ephem_data *data, int ut_time,
-        int csv, int verbose, int tz);
+        int csv, int verbose, int tz, long utc_offset);
+void print_csv_fields(struct ephem_data *sun_set,
+        struct ephem_data *sun_rise, struct ephem_data *moon_set,
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset);
 void print_csv(struct ephem_data *sun_set,
         struct ephem_data *sun_rise, struct ephem_data *moon_set,
-        struct ephem_data *moon_rise, int ut_time, int tz);
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset);
 void print_ordered(struct ephem_data *sun_set,
         struct ephem_data *sun_rise, struct ephem_data *moon_set,
-        struct ephem_data *moon_rise, int ut_time, int tz);
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset);
 int ephem_compar(const void *a, const void *b);
+void out_flush(void);
+void finish_output(void);
+double monotonic_seconds(void);
+void write_stats(FILE *file);
+int parse_date(const char *str, unsigned long *year, unsigned long *month,
+        unsigned long *day);
+int check_date(unsigned long year, unsigned long month, unsigned long day);
+double date_to_mjd(unsigned long year, unsigned long month, unsigned long day);
+void compute_nights(struct night_ephemeris *eph,
+        struct night_sequence *seqs, unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *nights, int *status);
+void print_nights(struct night_ephemeris *eph, struct night_sequence *seqs,
+        unsigned long year, unsigned long month, unsigned long day,
+        int binary, int csv, int ut_time, int tz);
+void print_result(struct ephem_night *night, int status, double mjd,
+        const struct vnight_site *site, int binary, int csv, int ut_time,
+        int tz);
+void format_result(struct ephem_night *night, int status, double mjd,
+        const struct vnight_site *site, int binary, int csv, int ut_time,
+        int tz);
+void print_binary(const struct ephem_night *night, int status);
+void print_windows(struct night_track *track, unsigned long year,
+        unsigned long month, unsigned long day, int csv, int ut_time,
+        int tz);
+void print_crossings(struct night_track *track, unsigned long year,
+        unsigned long month, unsigned long day, int csv, int ut_time,
+        int tz);
+void print_window(struct night_window *window,
+        const struct vnight_site *site, int csv, int ut_time, int tz);
+void print_series(const struct ephem_night *night, int status,
+        double mjd, const struct vnight_site *site);
+void out_bytes(const void *data, size_t n);
+void setup_moon_cheb(struct lunar_cheb *cheb, const char *file,
+        double start_jd, double stop_jd);
+int compute_range(int sequential, double start_mjd, int32_t nights,
+        int jobs, struct ephem_batch *results);
+void alloc_results(int32_t nights, struct ephem_batch *results);
+void free_results(struct ephem_batch *results);
+void print_cached_range(const char *dir, int sequential, int moon_cheb,
+        double start_mjd, double stop_mjd, int jobs, int binary, int csv,
+        int ut_time, int tz);
+void print_cache_key(int sequential, int moon_cheb);
+void warn_status(int status);
+void read_site(const char *path);
+void serve(const char *path, struct night_ephemeris *eph,
+        struct night_sequence *seqs, long capacity);
+void stop_signal(int sig);
+void print_from_server(const char *path, const struct vnight_query *queries,
+        uint32_t n_queries, int binary, int csv, int ut_time, int tz);
+
+/* night output is formatted into one buffer and written out a block at a
+   time, rather than through several printf calls per event. the format
+   is the same as the printf conversions it replaces, byte for byte. */
+static struct
+{
+    char data[65536];
+    size_t len;
+    int line_buffered;
+} out_buffer;
+
+/* long options without a short form */
+enum
+{
+    OPT_MOON_CHEB_CHECK = 256,
+    OPT_STATS,
+    OPT_SERVE,
+    OPT_SERVE_NIGHTS,
+    OPT_CONNECT,
+    OPT_CROSSINGS,
+    OPT_CACHE_KEY
+};
 
 int main(int argc, char **argv)
 {
@@ -79,30 +231,148 @@ int main(int argc, char **argv)
     argv0[sizeof(argv0) - 1] = '\0';
     pname = basename(argv0);
 
+    start_seconds = monotonic_seconds();
+    vnight_stats_reset();
+
+    /* night output is collected in out_buffer, see below */
+    atexit(finish_output);
+    out_buffer.line_buffered = isatty(STDOUT_FILENO);
+
+    int opt_binary = 0;
+    char *opt_cache = NULL;
+    int opt_cache_key = 0;
     int opt_csv = 0;
     int opt_help = 0;
+    int opt_jobs = 1;
+    int opt_moon_cheb = 0;
+    int opt_moon_cheb_check = 0;
+    char *opt_moon_cheb_file = NULL;
+    int opt_sequential = 0;
+    int opt_stdin = 0;
     int opt_ut = 1;
     int opt_tz = 0;
+    char *opt_start = NULL;
+    char *opt_stop = NULL;
+    char *opt_table = NULL;
+    char *opt_serve = NULL;
+    long opt_serve_nights = DEFAULT_SERVE_NIGHTS;
+    char *opt_connect = NULL;
     static struct option longopts[] =
     {
-        {"csv",     no_argument,     NULL,   'c'},
-        {"help",    no_argument,     NULL,   'h'},
-        {"local",   no_argument,     NULL,   'l'},
-        {"zone",    no_argument,     NULL,   'z'},
-        {NULL,      0,               NULL,   0}
+        {"binary",  no_argument,       NULL,   'b'},
+        {"csv",     no_argument,       NULL,   'c'},
+        {"cache",   required_argument, NULL,   'C'},
+        {"cache-key", no_argument,     NULL,   OPT_CACHE_KEY},
+        {"moon-series", required_argument, NULL, 'g'},
+        {"help",    no_argument,       NULL,   'h'},
+        {"stdin",   no_argument,       NULL,   'i'},
+        {"jobs",    required_argument, NULL,   'j'},
+        {"local",   no_argument,       NULL,   'l'},
+        {"moon-cheb", no_argument,     NULL,   'm'},
+        {"moon-cheb-file", required_argument, NULL, 'M'},
+        {"moon-cheb-check", no_argument, NULL, OPT_MOON_CHEB_CHECK},
+        {"sequential", no_argument,    NULL,   'q'},
+        {"start",   required_argument, NULL,   's'},
+        {"stats",   no_argument,       NULL,   OPT_STATS},
+        {"serve",   required_argument, NULL,   OPT_SERVE},
+        {"serve-nights", required_argument, NULL, OPT_SERVE_NIGHTS},
+        {"connect", required_argument, NULL,   OPT_CONNECT},
+        {"crossings", no_argument,     NULL,   OPT_CROSSINGS},
+        {"site",    required_argument, NULL,   'S'},
+        {"stop",    required_argument, NULL,   'e'},
+        {"table",   required_argument, NULL,   't'},
+        {"roots",   no_argument,       NULL,   'x'},
+        {"window",  no_argument,       NULL,   'w'},
+        {"zone",    no_argument,       NULL,   'z'},
+        {NULL,      0,                 NULL,   0}
     };
 
     int c;
-    while((c = getopt_long(argc, argv, "chlz", longopts, NULL)) != -1)
+    while((c = getopt_long(argc, argv, "bcC:g:hij:lmM:qs:S:e:t:wxz", longopts, NULL)) != -1)
     {
         switch (c)
         {
+            case 'b':
+               opt_binary = 1;
+               break;
             case 'c':
                opt_csv = 1;
                break; 
+            case 'C':
+               opt_cache = optarg;
+               break;
+            case OPT_CACHE_KEY:
+               opt_cache_key = 1;
+               break;
+            case 'g':
+               /* a minute at the finest, so a night fits in
+                  print_series */
+               series_step = atof(optarg)/1440.;
+               if (series_step < 1./1440.)
+                   opt_help = 1;
+               break;
+            case 'i':
+               opt_stdin = 1;
+               break;
+            case 'j':
+               opt_jobs = atoi(optarg);
+               if (opt_jobs < 1)
+                   opt_help = 1;
+               break;
             case 'l':
                opt_ut = 0;
                break;
+            case 'm':
+               opt_moon_cheb = 1;
+               break;
+            case 'M':
+               opt_moon_cheb = 1;
+               opt_moon_cheb_file = optarg;
+               break;
+            case OPT_MOON_CHEB_CHECK:
+               opt_moon_cheb = 1;
+               opt_moon_cheb_check = 1;
+               break;
+            case 'q':
+               opt_sequential = 1;
+               break;
+            case OPT_STATS:
+               print_stats = 1;
+               break;
+            case OPT_SERVE:
+               opt_serve = optarg;
+               break;
+            case OPT_SERVE_NIGHTS:
+               opt_serve_nights = atol(optarg);
+               if (opt_serve_nights < 1)
+                   opt_help = 1;
+               break;
+            case OPT_CONNECT:
+               opt_connect = optarg;
+               break;
+            case OPT_CROSSINGS:
+               crossings_mode = 1;
+               use_roots = 1;
+               break;
+            case 's':
+               opt_start = optarg;
+               break;
+            case 'S':
+               read_site(optarg);
+               break;
+            case 'e':
+               opt_stop = optarg;
+               break;
+            case 't':
+               opt_table = optarg;
+               break;
+            case 'w':
+               window_mode = 1;
+               use_roots = 1;
+               break;
+            case 'x':
+               use_roots = 1;
+               break;
             case 'z':
                opt_tz = 1;
                break;
@@ -120,7 +390,366 @@ int main(int argc, char **argv)
         exit(EXIT_SUCCESS);
     }
 
-    if (argc - optind != 3)
+    if (n_sites == 0)
+        sites[n_sites++] = veritas_site;
+
+    if (print_stats && !vnight_stats_enabled())
+    {
+        fprintf(stderr, "%s: --stats needs libvnight built with "
+                "-DVNIGHT_STATS.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+
+    /* binary records have no room for a site label, and a cache holds
+       the tables of one site */
+    if ((opt_binary || opt_table != NULL || series_step > 0. ||
+                opt_cache != NULL) && n_sites > 1)
+    {
+        fprintf(stderr, "%s: --binary, --table, --moon-series and --cache "
+                "take a single site.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+    /* a server answers for one site, and for the solver it was started
+       with */
+    if ((opt_serve != NULL || opt_connect != NULL) && (n_sites > 1 ||
+                series_step > 0. || opt_cache != NULL ||
+                opt_table != NULL || window_mode))
+    {
+        fprintf(stderr, "%s: --serve and --connect take a single site and "
+                "cannot be used with --moon-series, --cache, --table or "
+                "--window.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_connect != NULL && (opt_serve != NULL || opt_sequential ||
+                use_roots || opt_moon_cheb))
+    {
+        fprintf(stderr, "%s: --connect uses the solver of the server.\n",
+                pname);
+        exit(EXIT_FAILURE);
+    }
+    if (use_roots && opt_sequential)
+    {
+        fprintf(stderr, "%s: --roots cannot be used with --sequential.\n",
+                pname);
+        exit(EXIT_FAILURE);
+    }
+    /* windows are printed as they are computed by one process */
+    if (window_mode && (opt_binary || opt_table != NULL ||
+                series_step > 0. || opt_cache != NULL || opt_jobs > 1))
+    {
+        fprintf(stderr, "%s: --window cannot be used with --binary, "
+                "--table, --moon-series, --cache or --jobs.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+    /* crossings are printed as they are found by one process */
+    if (crossings_mode && (window_mode || opt_binary || opt_table != NULL ||
+                series_step > 0. || opt_cache != NULL || opt_jobs > 1 ||
+                opt_serve != NULL || opt_connect != NULL))
+    {
+        fprintf(stderr, "%s: --crossings cannot be used with --window, "
+                "--binary, --table, --moon-series, --cache, --jobs, --serve "
+                "or --connect.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+    if (opt_cache != NULL && opt_table != NULL)
+    {
+        fprintf(stderr, "%s: --cache cannot be used with --table.\n",
+                pname);
+        exit(EXIT_FAILURE);
+    }
+    /* drivers that read a cache themselves ask vnight where its tables
+       are, rather than make the key again */
+    if (opt_cache_key)
+    {
+        if (n_sites > 1)
+        {
+            fprintf(stderr, "%s: --cache-key takes a single site.\n",
+                    pname);
+            exit(EXIT_FAILURE);
+        }
+        print_cache_key(opt_sequential, opt_moon_cheb);
+        exit(EXIT_SUCCESS);
+    }
+    if (series_step > 0. && (opt_binary || opt_table != NULL))
+    {
+        fprintf(stderr, "%s: --moon-series cannot be used with --binary or "
+                "--table.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned long ut_year, ut_month, ut_day;
+
+    /* state for the sequential solver, one per site, only used in batch
+       modes */
+    struct night_sequence sequence[MAX_SITES];
+    struct night_sequence *seqs = NULL;
+    if (opt_sequential)
+    {
+        for (int k = 0; k < n_sites; k++)
+            init_night_sequence(&sequence[k]);
+        seqs = sequence;
+    }
+
+    /* geocentric positions shared by every site */
+    struct night_ephemeris eph;
+    init_night_ephemeris(&eph);
+    struct night_track track;
+    if (use_roots)
+    {
+        init_night_track(&track);
+        eph.track = &track;
+    }
+
+    struct lunar_cheb cheb;
+
+    if (opt_serve != NULL)
+    {
+        if (argc - optind != 0 || opt_start != NULL || opt_stop != NULL ||
+                opt_stdin || opt_binary)
+        {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+        /* the dates asked for are not known up front, as with --stdin */
+        if (opt_moon_cheb)
+        {
+            if (opt_moon_cheb_file == NULL || opt_moon_cheb_check ||
+                    lunar_cheb_read(&cheb, opt_moon_cheb_file) != VNIGHT_OK)
+            {
+                fprintf(stderr, "%s: --serve needs an existing "
+                        "--moon-cheb-file.\n", pname);
+                exit(EXIT_FAILURE);
+            }
+            vnight_set_lunar_cheb(&cheb);
+        }
+        serve(opt_serve, &eph, seqs, opt_serve_nights);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* batch mode, read dates from stdin. one night is computed per line so
+       that a driver like vsched.py only has to start this program once. */
+    if (opt_stdin)
+    {
+        if (argc - optind != 0 || opt_start != NULL || opt_stop != NULL ||
+                opt_binary || series_step > 0. || opt_cache != NULL)
+        {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+
+        /* the date range is not known up front, so a fit can only come
+           from an existing file */
+        if (opt_moon_cheb)
+        {
+            if (opt_moon_cheb_file == NULL || opt_moon_cheb_check ||
+                    lunar_cheb_read(&cheb, opt_moon_cheb_file) != VNIGHT_OK)
+            {
+                fprintf(stderr, "%s: --stdin needs an existing "
+                        "--moon-cheb-file.\n", pname);
+                exit(EXIT_FAILURE);
+            }
+            vnight_set_lunar_cheb(&cheb);
+        }
+
+        /* dates for the server, consecutive ones as one query */
+        struct vnight_query *queries = NULL;
+        uint32_t n_queries = 0;
+        size_t queries_size = 0;
+
+        char line[256];
+        while (fgets(line, sizeof(line), stdin) != NULL)
+        {
+            /* skip blank lines */
+            if (strspn(line, " \t\r\n") == strlen(line))
+                continue;
+            if (parse_date(line, &ut_year, &ut_month, &ut_day) != 0)
+            {
+                fprintf(stderr, "%s: Invalid date: %s", pname, line);
+                exit(EXIT_FAILURE);
+            }
+            if (opt_connect == NULL)
+            {
+                print_nights(&eph, seqs, ut_year, ut_month, ut_day, 0,
+                        opt_csv, opt_ut, opt_tz);
+                continue;
+            }
+
+            double mjd = date_to_mjd(ut_year, ut_month, ut_day);
+            struct vnight_query *last = n_queries > 0 ?
+                &queries[n_queries - 1] : NULL;
+            if (last != NULL && last->start_mjd + last->nights == mjd)
+            {
+                last->nights++;
+                continue;
+            }
+            if (n_queries == queries_size)
+            {
+                queries_size = queries_size > 0 ? 2*queries_size : 64;
+                queries = realloc(queries, queries_size*sizeof(*queries));
+                if (queries == NULL)
+                {
+                    fprintf(stderr, "%s: Out of memory.\n", pname);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memset(&queries[n_queries], 0, sizeof(queries[0]));
+            queries[n_queries].start_mjd = mjd;
+            queries[n_queries].nights = 1;
+            n_queries++;
+        }
+
+        if (opt_connect != NULL)
+            print_from_server(opt_connect, queries, n_queries, 0, opt_csv,
+                    opt_ut, opt_tz);
+        free(queries);
+        exit(EXIT_SUCCESS);
+    }
+
+    /* batch mode, every night from start to stop date inclusive */
+    if (opt_start != NULL || opt_stop != NULL)
+    {
+        if (argc - optind != 0 || opt_start == NULL || opt_stop == NULL)
+        {
+            usage();
+            exit(EXIT_FAILURE);
+        }
+
+        unsigned long stop_year, stop_month, stop_day;
+        if (parse_date(opt_start, &ut_year, &ut_month, &ut_day) != 0)
+        {
+            fprintf(stderr, "%s: Invalid start date.\n", pname);
+            exit(EXIT_FAILURE);
+        }
+        if (parse_date(opt_stop, &stop_year, &stop_month, &stop_day) != 0)
+        {
+            fprintf(stderr, "%s: Invalid stop date.\n", pname);
+            exit(EXIT_FAILURE);
+        }
+
+        double start_mjd = date_to_mjd(ut_year, ut_month, ut_day);
+        double stop_mjd = date_to_mjd(stop_year, stop_month, stop_day);
+
+        if (opt_moon_cheb)
+        {
+            /* margin for moon positions the solvers take on the days
+               before and after each night */
+            setup_moon_cheb(&cheb, opt_moon_cheb_file,
+                    start_mjd + 2400000.5 - 2., stop_mjd + 2400000.5 + 3.);
+            if (opt_moon_cheb_check)
+            {
+                struct lunar_cheb_error err;
+                lunar_cheb_validate(&cheb, 1./96., &err);
+                printf("moon chebyshev fit, %lu samples, maximum error:\n",
+                        err.samples);
+                printf("  ra:    %.6f arcsec\n", err.ra);
+                printf("  dec:   %.6f arcsec\n", err.dec);
+                printf("  dist:  %.6f km\n", err.dist);
+                printf("  illum: %.3e\n", err.illum);
+                exit(EXIT_SUCCESS);
+            }
+        }
+
+        int32_t nights = (int32_t)(stop_mjd - start_mjd) + 1;
+        if (nights < 1)
+        {
+            fprintf(stderr, "%s: Stop date is before start date.\n", pname);
+            exit(EXIT_FAILURE);
+        }
+
+        if (opt_binary && opt_table == NULL)
+        {
+            struct ephem_table_header header;
+            ephem_table_header_init(&header, &sites[0], start_mjd, nights);
+            out_bytes(&header, sizeof(header));
+            out_flush();
+        }
+        if (series_step > 0.)
+        {
+            struct moon_series_header header;
+            moon_series_header_init(&header, &sites[0], start_mjd, nights,
+                    series_step);
+            out_bytes(&header, sizeof(header));
+        }
+
+        if (opt_connect != NULL)
+        {
+            struct vnight_query query;
+            memset(&query, 0, sizeof(query));
+            query.start_mjd = start_mjd;
+            query.nights = nights;
+            print_from_server(opt_connect, &query, 1, opt_binary, opt_csv,
+                    opt_ut, opt_tz);
+            exit(EXIT_SUCCESS);
+        }
+
+        if (opt_cache != NULL)
+        {
+            print_cached_range(opt_cache, opt_sequential, opt_moon_cheb,
+                    start_mjd, stop_mjd, opt_jobs, opt_binary, opt_csv,
+                    opt_ut, opt_tz);
+            exit(EXIT_SUCCESS);
+        }
+
+        /* one process prints each night as soon as it is computed */
+        if (opt_table == NULL && opt_jobs == 1)
+        {
+            for (double mjd = start_mjd; mjd <= stop_mjd; mjd += 1.)
+            {
+                /* mjd is at 0h UT, convert back to a calendar date */
+                struct ln_date date;
+                ln_get_date(mjd + 2400000.5, &date);
+                print_nights(&eph, seqs, date.years, date.months, date.days,
+                        opt_binary, opt_csv, opt_ut, opt_tz);
+            }
+            exit(EXIT_SUCCESS);
+        }
+
+        struct ephem_batch results;
+        alloc_results(nights, &results);
+
+        if (compute_range(opt_sequential, start_mjd, nights, opt_jobs,
+                    &results) != 0)
+        {
+            fprintf(stderr, "%s: Could not compute nights.\n", pname);
+            exit(EXIT_FAILURE);
+        }
+
+        if (opt_table != NULL)
+        {
+            struct ephem_table_record *records = malloc(nights*
+                    sizeof(struct ephem_table_record));
+            if (records == NULL)
+            {
+                fprintf(stderr, "%s: Out of memory.\n", pname);
+                exit(EXIT_FAILURE);
+            }
+            for (int32_t i = 0; i < nights; i++)
+                ephem_batch_record(&results, i, &records[i]);
+            int write_status = ephem_table_write(opt_table, &sites[0],
+                    start_mjd, nights, records);
+            free(records);
+            if (write_status != VNIGHT_OK)
+            {
+                fprintf(stderr, "%s: Could not write %s: %s.\n", pname,
+                        opt_table, vnight_strerror(write_status));
+                exit(EXIT_FAILURE);
+            }
+            exit(EXIT_SUCCESS);
+        }
+
+        for (size_t i = 0; i < (size_t)nights*n_sites; i++)
+        {
+            struct ephem_night night;
+            int status = ephem_batch_get(&results, i, &night);
+            print_result(&night, status, start_mjd + i/n_sites,
+                    &sites[i % n_sites], opt_binary, opt_csv, opt_ut, opt_tz);
+        }
+
+        exit(EXIT_SUCCESS);
+    }
+
+    if (argc - optind != 3 || opt_binary || series_step > 0. ||
+            opt_cache != NULL)
     {
         usage();
         exit(EXIT_FAILURE);
@@ -132,265 +761,1038 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    unsigned long ut_year, ut_month, ut_day;
     ut_year  = strtoul(argv[optind], NULL, 10);
     ut_month = strtoul(argv[optind + 1], NULL, 10);
     ut_day   = strtoul(argv[optind + 2], NULL, 10);
     
-    if (ut_month > 12)
+    if (check_date(ut_year, ut_month, ut_day) != 0)
+        exit(EXIT_FAILURE);
+
+    if (opt_connect != NULL)
+    {
+        struct vnight_query query;
+        memset(&query, 0, sizeof(query));
+        query.start_mjd = date_to_mjd(ut_year, ut_month, ut_day);
+        query.nights = 1;
+        print_from_server(opt_connect, &query, 1, 0, opt_csv, opt_ut,
+                opt_tz);
+        exit(EXIT_SUCCESS);
+    }
+
+    print_nights(&eph, NULL, ut_year, ut_month, ut_day, 0, opt_csv, opt_ut,
+            opt_tz);
+
+    exit(EXIT_SUCCESS);
+}
+
+/* parse a date of the form YYYY-MM-DD. returns 0 on success. */
+int parse_date(const char *str, unsigned long *year, unsigned long *month,
+        unsigned long *day)
+{
+    int n = 0;
+    while (*str == ' ' || *str == '\t')
+        str++;
+    if (sscanf(str, "%4lu-%2lu-%2lu%n", year, month, day, &n) != 3 || n != 10)
+        return 1;
+    if (strspn(str + n, " \t\r\n") != strlen(str + n))
+        return 1;
+
+    return check_date(*year, *month, *day);
+}
+
+/* sanity check a UT date. prints an error message and returns non-zero if
+   the date is no good. */
+int check_date(unsigned long year, unsigned long month, unsigned long day)
+{
+    (void)year;
+
+    if (month > 12)
     {
         fprintf(stderr, "%s: Invalid month.\n", pname);
-        exit(EXIT_FAILURE);
+        return 1;
     }
 
-    if (ut_day > 31)
+    if (day > 31)
     {
         fprintf(stderr, "%s: Invalid day.\n", pname);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* modified julian date at 0h UT on the specified date */
+double date_to_mjd(unsigned long year, unsigned long month, unsigned long day)
+{
+    double mjd;
+
+    if (vnight_date_to_mjd(year, month, day, &mjd) != VNIGHT_OK)
+    {
+        fprintf(stderr, "%s: Invalid date %04lu-%02lu-%02lu.\n", pname, year,
+                month, day);
         exit(EXIT_FAILURE);
     }
 
-    /* get the moon rise and set times */
-    struct ephem_data moon_rise;
-    struct ephem_data moon_set;
-    get_moon_rise_set(ut_year, ut_month, ut_day, &moon_rise, &moon_set);
-    /* print_ephem_data(&moon_rise, opt_ut, 0, 1, opt_tz); */
-    /* print_ephem_data(&moon_set, opt_ut, 0, 1, opt_tz); */
+    return mjd;
+}
 
-    /* get the sun rise and set times */
-    struct ephem_data sun_rise;
-    struct ephem_data sun_set;
-    get_sun_rise_set(ut_year, ut_month, ut_day, &sun_rise, &sun_set);
-    /* print_ephem_data(&sun_rise, opt_ut, 0, 1, opt_tz); */
-    /* print_ephem_data(&sun_set, opt_ut, 0, 1, opt_tz); */
+/* load the moon fit from file, or build it for start_jd to stop_jd, and
+   make libvnight use it. a file that is missing or does not cover the
+   range is rewritten. */
+void setup_moon_cheb(struct lunar_cheb *cheb, const char *file,
+        double start_jd, double stop_jd)
+{
+    if (file != NULL && lunar_cheb_read(cheb, file) == VNIGHT_OK)
+    {
+        if (lunar_cheb_covers(cheb, start_jd, stop_jd))
+        {
+            vnight_set_lunar_cheb(cheb);
+            return;
+        }
+        lunar_cheb_free(cheb);
+    }
 
-    if (opt_csv)
-        print_csv(&sun_set, &sun_rise, &moon_set, &moon_rise, opt_ut, opt_tz);
-    else
-        print_ordered(&sun_set, &sun_rise, &moon_set, &moon_rise, opt_ut,
-                opt_tz);
+    int status = lunar_cheb_build(cheb, start_jd, stop_jd);
+    if (status != VNIGHT_OK)
+    {
+        fprintf(stderr, "%s: Could not fit moon: %s.\n", pname,
+                vnight_strerror(status));
+        exit(EXIT_FAILURE);
+    }
 
-    exit(EXIT_SUCCESS);
+    if (file != NULL && lunar_cheb_write(cheb, file) != VNIGHT_OK)
+        fprintf(stderr, "%s: Warning could not write %s\n", pname, file);
+
+    vnight_set_lunar_cheb(cheb);
 }
 
+/* add the site in path to the sites computed, exits if it cannot be
+   read */
+void read_site(const char *path)
+{
+    if (n_sites == MAX_SITES)
+    {
+        fprintf(stderr, "%s: Too many sites, at most %d.\n", pname,
+                MAX_SITES);
+        exit(EXIT_FAILURE);
+    }
+    if (vnight_site_read(path, &sites[n_sites]) != VNIGHT_OK)
+    {
+        fprintf(stderr, "%s: Could not read site %s.\n", pname, path);
+        exit(EXIT_FAILURE);
+    }
+    n_sites++;
+}
 
-int get_moon_rise_set(unsigned long year, unsigned long month,
-        unsigned long day, struct ephem_data *rise, struct ephem_data *set)
+/* compute the sun and moon events for one UT date at every site into
+   nights and status, printing warnings for events that could not be
+   computed. the sites share the positions in eph. if seqs is not NULL it
+   has a sequential solver for each site. */
+void compute_nights(struct night_ephemeris *eph,
+        struct night_sequence *seqs, unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *nights, int *status)
 {
-    /* this function is written to mimic how loggen routines determine
-       event times. those routines do not set observer elevation or
-       make correction for refraction. */
-    struct ln_lnlat_posn observer;
-    observer.lat = veritas_latitude;
-    observer.lng = veritas_longitude;
+    if (get_night_ephem_sites(eph, sites, n_sites, seqs, year, month, day,
+                nights, status) & VNIGHT_BAD_DATE)
+    {
+        fprintf(stderr, "%s: Invalid date %04lu-%02lu-%02lu.\n", pname, year,
+                month, day);
+        exit(EXIT_FAILURE);
+    }
+    for (int k = 0; k < n_sites; k++)
+        warn_status(status[k]);
+}
 
-    int status;
-    double mjd;
+/* warnings for events of a night that could not be computed */
+void warn_status(int status)
+{
+    if (status & VNIGHT_MOON_CIRCUMPOLAR)
+        fprintf(stderr, "%s: Warning moon is circumpolar\n", pname);
+    if (status & VNIGHT_SUN_CIRCUMPOLAR)
+        fprintf(stderr, "%s: Warning sun is circumpolar\n", pname);
+}
 
-    slaCaldj((int)year, (int)month, (int)day, &mjd, &status);
-    if (status != 0)
+/* compute nights start_mjd to start_mjd + nights - 1 into results, in
+   date order and in site order within each date. with more
+   than one job the range is split into
+   contiguous blocks, one per forked worker. libnova is not reentrant, the
+   lunar theory and nutation (and so sidereal time and the solar position)
+   keep their state in statics, so the workers are processes rather than
+   threads. each worker starts its own sequential solver at the beginning
+   of its block. results must be in shared memory when jobs is more than
+   one. returns non-zero if a worker failed. */
+int compute_range(int sequential, double start_mjd, int32_t nights,
+        int jobs, struct ephem_batch *results)
+{
+    if (jobs > nights)
+        jobs = nights;
+
+    /* each worker leaves its counts here for the parent to add up */
+    struct vnight_stats *job_stats = NULL;
+    if (jobs > 1 && print_stats)
     {
-        fprintf(stderr, "%s: slaCaldj failed.\n", pname);
-        exit(EXIT_FAILURE);
+        job_stats = mmap(NULL, jobs*sizeof(*job_stats),
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (job_stats == MAP_FAILED)
+            return 1;
+        memset(job_stats, 0, jobs*sizeof(*job_stats));
     }
 
-    double jd = mjd + 2400000;
+    int failed = 0;
+    int running = 0;
+    for (int j = 0; j < jobs; j++)
+    {
+        int32_t begin = (int32_t)((int64_t)nights*j/jobs);
+        int32_t end = (int32_t)((int64_t)nights*(j + 1)/jobs);
+
+        pid_t pid = 0;
+        if (jobs > 1)
+        {
+            pid = fork();
+            if (pid < 0)
+            {
+                failed = 1;
+                break;
+            }
+            if (pid > 0)
+            {
+                running++;
+                continue;
+            }
+            /* only count what this worker does */
+            vnight_stats_reset();
+        }
+
+        struct night_ephemeris eph;
+        init_night_ephemeris(&eph);
+        struct night_track track;
+        if (use_roots)
+        {
+            init_night_track(&track);
+            eph.track = &track;
+        }
+        struct night_sequence sequence[MAX_SITES];
+        for (int k = 0; k < n_sites; k++)
+            init_night_sequence(&sequence[k]);
+        for (int32_t i = begin; i < end; i++)
+        {
+            /* mjd is at 0h UT, convert back to a calendar date */
+            struct ln_date date;
+            ln_get_date(start_mjd + i + 2400000.5, &date);
+            struct ephem_night night[MAX_SITES];
+            int status[MAX_SITES];
+            compute_nights(&eph, sequential ? sequence : NULL, date.years,
+                    date.months, date.days, night, status);
+            for (int k = 0; k < n_sites; k++)
+                ephem_batch_put(results, (size_t)i*n_sites + k, &night[k],
+                        status[k]);
+        }
 
-    struct ln_rst_time lunar_rst;
-    status = ln_get_lunar_rst(jd, &observer, &lunar_rst);
-    /* if status = 1, then moon is circumpolar and remains above or below
-     * the horizon for the entire day */
-    if (status == 1)
+        if (jobs > 1)
+        {
+            if (job_stats != NULL)
+                job_stats[j] = vnight_thread_stats;
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    for (; running > 0; running--)
     {
-        fprintf(stderr, "%s: Warning moon is circumpolar\n", pname);
-        return 1;
+        int wstatus;
+        if (wait(&wstatus) < 0 || !WIFEXITED(wstatus) ||
+                WEXITSTATUS(wstatus) != EXIT_SUCCESS)
+            failed = 1;
     }
 
-    rise->jd = lunar_rst.rise;
-    ln_get_date(lunar_rst.rise, &(rise->date));
-    rise->moon_illum = ln_get_lunar_disk(lunar_rst.rise);
-    strcpy(rise->label, "Moon Rise");
+    if (job_stats != NULL)
+    {
+        for (int j = 0; j < jobs; j++)
+            vnight_stats_add(&worker_stats, &job_stats[j]);
+        processes += jobs;
+        munmap(job_stats, jobs*sizeof(*job_stats));
+    }
 
-    set->jd = lunar_rst.set;
-    ln_get_date(lunar_rst.set, &(set->date));
-    set->moon_illum = ln_get_lunar_disk(lunar_rst.set);
-    strcpy(set->label, "Moon Set");
+    return failed;
+}
 
-    return 0;
+/* results for nights dates at every site. they are shared with the
+   worker processes of compute_range, which write their nights in place.
+   exits if there is no memory. */
+void alloc_results(int32_t nights, struct ephem_batch *results)
+{
+    size_t size = ephem_batch_size((size_t)nights*n_sites);
+    void *shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        fprintf(stderr, "%s: Out of memory.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+    ephem_batch_init(results, shared, (size_t)nights*n_sites);
 }
 
-/* calculates sun rise and set times for UT date specified by year, month, and
-   day. moon_rise data is given to provide moon fraction at sun rise and
-   set times. if the moon is not above the horizon, then fraction is set to
-   -1. */
-int get_sun_rise_set(unsigned long year, unsigned long month,
-        unsigned long day, struct ephem_data *rise, struct ephem_data *set)
+void free_results(struct ephem_batch *results)
 {
-    /* this function is written to mimic how loggen routines determine
-       event times. those routines do not set observer elevation or
-       make correction for refraction. */
-    struct ln_lnlat_posn observer;
-    observer.lat = veritas_latitude;
-    observer.lng = veritas_longitude;
+    munmap(results->jd, ephem_batch_size(results->nights));
+}
 
-    int status;
-    double mjd;
+/* name of the solver in the cache key. results of the other solvers
+   differ from the default solver by up to seconds, so they are kept
+   apart */
+static const char *cache_solver(int sequential, int moon_cheb)
+{
+    if (use_roots)
+        return moon_cheb ? "roots-cheb" : "roots";
+    return sequential ? (moon_cheb ? "seq-cheb" : "seq")
+        : (moon_cheb ? "cheb" : "exact");
+}
 
-    slaCaldj((int)year, (int)month, (int)day, &mjd, &status);
-    if (status != 0)
+void print_cache_key(int sequential, int moon_cheb)
+{
+    char key[VNIGHT_CACHE_KEY_SIZE];
+    int status = ephem_cache_key(key, sizeof(key), &sites[0],
+            cache_solver(sequential, moon_cheb));
+    if (status != VNIGHT_OK)
     {
-        fprintf(stderr, "%s: slaCaldj failed.\n", pname);
+        fprintf(stderr, "%s: Could not make the cache key: %s.\n", pname,
+                vnight_strerror(status));
         exit(EXIT_FAILURE);
     }
+    printf("%s\n", key);
+}
 
-    double jd = mjd + 2400000;
+/* print start_mjd to stop_mjd at the first site from the cache in dir.
+   each run of nights missing from a year's table is computed with
+   compute_range, printed, and the table stored again once the year is
+   done. nights from the cache are printed as they were computed, and
+   warned about the same way. */
+void print_cached_range(const char *dir, int sequential, int moon_cheb,
+        double start_mjd, double stop_mjd, int jobs, int binary, int csv,
+        int ut_time, int tz)
+{
+    const char *solver = cache_solver(sequential, moon_cheb);
 
-    /* multiple calls are required for rise and set times because position
-       below the horizon is different for VERITAS twilight at the beginning
-       and end of observing nights */
-    struct ln_rst_time solar_rst;
-    /* compute sun set first */
-    status = ln_get_solar_rst_horizon(jd, &observer, horizon_angle_begin,
-            &solar_rst);
-    /* if status = 0, success
-       if status = 1 (-1), then sun is circumpolar and remains above (below)
-       the horizon for the entire day */
-    if (status != 0)
+    struct ln_date first, last;
+    ln_get_date(start_mjd + 2400000.5, &first);
+    ln_get_date(stop_mjd + 2400000.5, &last);
+    for (int year = first.years; year <= last.years; year++)
     {
-        fprintf(stderr, "%s: Warning sun is circumpolar\n", pname);
-        return 1;
+        double year_mjd;
+        int32_t nights;
+        struct ephem_table_record *records;
+        int load_status = ephem_cache_load(dir, &sites[0], solver, year,
+                &year_mjd, &nights, &records);
+        if (load_status != VNIGHT_OK)
+        {
+            fprintf(stderr, "%s: Could not read cache %s: %s.\n", pname,
+                    dir, vnight_strerror(load_status));
+            exit(EXIT_FAILURE);
+        }
+
+        int32_t begin = start_mjd > year_mjd ?
+            (int32_t)(start_mjd - year_mjd) : 0;
+        int32_t end = stop_mjd < year_mjd + nights - 1 ?
+            (int32_t)(stop_mjd - year_mjd) + 1 : nights;
+        int filled = 0;
+        for (int32_t i = begin; i < end;)
+        {
+            struct ephem_night night;
+            if (records[i].status != VNIGHT_NOT_CACHED)
+            {
+                VNIGHT_COUNT(VNIGHT_STAT_NIGHT_CACHE_HITS);
+                warn_status(records[i].status);
+                ephem_night_from_table_record(&records[i], &night);
+                print_result(&night, records[i].status, year_mjd + i,
+                        &sites[0], binary, csv, ut_time, tz);
+                i++;
+                continue;
+            }
+
+            int32_t run = 1;
+            while (i + run < end &&
+                    records[i + run].status == VNIGHT_NOT_CACHED)
+                run++;
+            VNIGHT_COUNT_N(VNIGHT_STAT_NIGHT_CACHE_MISSES, run);
+
+            struct ephem_batch results;
+            alloc_results(run, &results);
+            if (compute_range(sequential, year_mjd + i, run, jobs,
+                        &results) != 0)
+            {
+                fprintf(stderr, "%s: Could not compute nights.\n", pname);
+                exit(EXIT_FAILURE);
+            }
+            for (int32_t j = 0; j < run; j++)
+            {
+                ephem_batch_record(&results, j, &records[i + j]);
+                ephem_night_from_table_record(&records[i + j], &night);
+                print_result(&night, records[i + j].status,
+                        year_mjd + i + j, &sites[0], binary, csv, ut_time,
+                        tz);
+            }
+            free_results(&results);
+            filled = 1;
+            i += run;
+        }
+
+        /* the nights are printed either way, a cache that cannot be
+           written only costs the next run the time to compute them */
+        if (filled && ephem_cache_store(dir, &sites[0], solver, year,
+                    year_mjd, nights, records) != VNIGHT_OK)
+            fprintf(stderr, "%s: Warning could not write cache %s\n", pname,
+                    dir);
+        free(records);
     }
-    else
+}
+
+void stop_signal(int sig)
+{
+    (void)sig;
+    stop_server = 1;
+}
+
+/* run the server at path on the first site until SIGINT or SIGTERM. the
+   stats, if asked for, are written when it stops. */
+void serve(const char *path, struct night_ephemeris *eph,
+        struct night_sequence *seqs, long capacity)
+{
+    struct night_lru lru;
+    if (night_lru_init(&lru, (size_t)capacity) != VNIGHT_OK)
     {
-        ln_get_date(solar_rst.set, &(set->date));
-        
-        set->jd = solar_rst.set;
-        /* is the moon above the horizon when the sun sets? */
-        get_moon_alt_and_illum(solar_rst.set, &observer, &(set->moon_alt),
-                &(set->moon_illum));
+        fprintf(stderr, "%s: Out of memory.\n", pname);
+        exit(EXIT_FAILURE);
+    }
+
+    /* no SA_RESTART, so that a signal ends a wait in the server loop */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
 
-        strcpy(set->label, "Sun Set");
+    if (vnight_serve(path, &sites[0], eph, seqs, &lru, &stop_server)
+            != VNIGHT_OK)
+    {
+        fprintf(stderr, "%s: Could not serve on %s: %s.\n", pname, path,
+                strerror(errno));
+        exit(EXIT_FAILURE);
     }
+    night_lru_free(&lru);
+}
 
-    /* now compute sun rise */
-    status = ln_get_solar_rst_horizon(jd, &observer, horizon_angle_end,
-            &solar_rst);
-    /* if status = 0, success
-       if status = 1 (-1), then sun is circumpolar and remains above (below)
-       the horizon for the entire day */
-    if (status != 0)
+/* print the nights of queries from the server at path, in query order.
+   the nights are warned about as if they were computed here. */
+void print_from_server(const char *path, const struct vnight_query *queries,
+        uint32_t n_queries, int binary, int csv, int ut_time, int tz)
+{
+    struct ephem_table_record *records;
+    uint32_t n_records;
+    int status = vnight_query(path, queries, n_queries, &records,
+            &n_records);
+    if (status != VNIGHT_OK)
     {
-        fprintf(stderr, "%s: Warning sun is circumpolar\n", pname);
-        return 1;
+        fprintf(stderr, "%s: Could not query %s: %s.\n", pname, path,
+                vnight_strerror(status));
+        exit(EXIT_FAILURE);
     }
-    else
+
+    uint32_t r = 0;
+    for (uint32_t q = 0; q < n_queries; q++)
     {
-        ln_get_date(solar_rst.rise, &(rise->date));
+        for (int32_t i = 0; i < queries[q].nights && r < n_records; i++, r++)
+        {
+            struct ephem_night night;
+            warn_status(records[r].status);
+            ephem_night_from_table_record(&records[r], &night);
+            print_result(&night, records[r].status,
+                    queries[q].start_mjd + i, &sites[0], binary, csv,
+                    ut_time, tz);
+        }
+    }
+    free(records);
+}
 
-        rise->jd = solar_rst.rise;
-        /* is the moon above the horizon when the sun rises? */
-        get_moon_alt_and_illum(solar_rst.rise, &observer, &(rise->moon_alt),
-                &(rise->moon_illum));
+/* longest single piece of output appended at once */
+#define OUT_MAX_FIELD 256
 
-        strcpy(rise->label, "Sun Rise");
+void out_flush(void)
+{
+    const char *p = out_buffer.data;
+    size_t len = out_buffer.len;
+    while (len > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        /* nothing more can be written, e.g. the reader went away */
+        if (n <= 0)
+            break;
+        p += n;
+        len -= n;
     }
+    out_buffer.len = 0;
+}
 
-    return 0;
+/* last of the output, then the stats if they were asked for */
+void finish_output(void)
+{
+    VNIGHT_TIMER_START(VNIGHT_TIME_OUTPUT);
+    out_flush();
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_OUTPUT);
+    if (print_stats)
+        write_stats(stderr);
 }
 
-void get_moon_alt_and_illum(double jd, struct ln_lnlat_posn *observer,
-        double *alt, double *illum)
+double monotonic_seconds(void)
 {
-    struct ln_equ_posn equ_posn;
-    ln_get_lunar_equ_coords(jd, &equ_posn);
-    struct ln_hrz_posn hrz_posn;
-    ln_get_hrz_from_equ(&equ_posn, observer, jd, &hrz_posn);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
 
-    *alt = hrz_posn.alt;
-    *illum = ln_get_lunar_disk(jd);
+/* counts of this process and its workers as one JSON object. the wall
+   time against the time in the solvers and the output tells a run that
+   is busy computing from one that waits on its reader, and a short run
+   with little of either is mostly spent starting up. */
+void write_stats(FILE *file)
+{
+    double wall = monotonic_seconds() - start_seconds;
+    struct vnight_stats stats = worker_stats;
+    vnight_stats_add(&stats, &vnight_thread_stats);
+    double rate = vnight_ticks_per_second();
 
-    if (*alt < 0.)
-        *illum *= -1.;
+    fprintf(file, "{\"wall_seconds\": %.6f, \"processes\": %d, "
+            "\"ticks_per_second\": %.0f,\n \"counters\": {", wall,
+            processes, rate);
+    for (int i = 0; i < VNIGHT_STAT_COUNTERS; i++)
+        fprintf(file, "%s\"%s\": %llu", i > 0 ? ", " : "",
+                vnight_counter_name(i), (unsigned long long)stats.count[i]);
+    fprintf(file, "},\n \"timers\": {");
+    for (int i = 0; i < VNIGHT_STAT_TIMERS; i++)
+        fprintf(file, "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6f}",
+                i > 0 ? ",\n   " : "", vnight_timer_name(i),
+                (unsigned long long)stats.calls[i], stats.ticks[i]/rate);
+    fprintf(file, "}}\n");
+}
 
-    return;
+/* room for at least one more field */
+static char *out_reserve(void)
+{
+    if (out_buffer.len > sizeof(out_buffer.data) - OUT_MAX_FIELD)
+        out_flush();
+    return out_buffer.data + out_buffer.len;
+}
+
+static void out_printf(const char *fmt, ...)
+{
+    char *p = out_reserve();
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(p, OUT_MAX_FIELD, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        out_buffer.len += n < OUT_MAX_FIELD ? n : OUT_MAX_FIELD - 1;
+}
+
+static void out_char(char c)
+{
+    *out_reserve() = c;
+    out_buffer.len++;
+}
+
+static void out_str(const char *str)
+{
+    size_t n = strlen(str);
+    if (n >= OUT_MAX_FIELD)
+    {
+        out_printf("%s", str);
+        return;
+    }
+    memcpy(out_reserve(), str, n);
+    out_buffer.len += n;
+}
+
+/* end of a night, written out right away when stdout is a terminal like
+   stdio would */
+static void out_end_line(void)
+{
+    out_char('\n');
+    if (out_buffer.line_buffered)
+        out_flush();
+}
+
+void out_bytes(const void *data, size_t n)
+{
+    const char *p = data;
+    while (n > 0)
+    {
+        size_t chunk = n < OUT_MAX_FIELD ? n : OUT_MAX_FIELD;
+        memcpy(out_reserve(), p, chunk);
+        out_buffer.len += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+/* %0<width>d */
+static void out_int(int value, int width)
+{
+    if (value < 0 || width > 10)
+    {
+        out_printf("%0*d", width, value);
+        return;
+    }
+
+    char digits[10];
+    int n = 0;
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    char *p = out_reserve();
+    int len = 0;
+    for (; width > n; width--)
+        p[len++] = '0';
+    while (n > 0)
+        p[len++] = digits[--n];
+    out_buffer.len += len;
+}
+
+/* %<pad><width>.<decimals>f, pad is '0' or ' '. values are rounded from
+   the exact binary value like printf does. a value within rounding error
+   of halfway between two outputs, and anything too large or not finite,
+   is left to printf. */
+static void out_fixed(double value, int width, int decimals, char pad)
+{
+    static const double scales[] = {1., 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+    double x = fabs(value);
+    if (decimals > 6 || !(x < 1e9))
+    {
+        out_printf(pad == '0' ? "%0*.*f" : "%*.*f", width, decimals, value);
+        return;
+    }
+
+    double scale = scales[decimals];
+    double n = floor(x*scale);
+    /* x*scale - n with a single rounding, so it is on the right side of a
+       half unless it is within rounding error of it */
+    double rest = fma(x, scale, -n);
+    if (rest < 0.)
+    {
+        n -= 1.;
+        rest += 1.;
+    }
+    else if (rest >= 1.)
+    {
+        n += 1.;
+        rest -= 1.;
+    }
+    if (rest == 0.5)
+    {
+        out_printf(pad == '0' ? "%0*.*f" : "%*.*f", width, decimals, value);
+        return;
+    }
+    unsigned long long digits = (unsigned long long)n + (rest > 0.5);
+
+    char text[32];
+    int len = sizeof(text);
+    for (int i = 0; i < decimals; i++)
+    {
+        text[--len] = '0' + digits % 10;
+        digits /= 10;
+    }
+    if (decimals > 0)
+        text[--len] = '.';
+    do
+    {
+        text[--len] = '0' + digits % 10;
+        digits /= 10;
+    } while (digits > 0);
+
+    int sign = signbit(value) != 0;
+    int n_text = (int)sizeof(text) - len;
+    char *p = out_reserve();
+    int out = 0;
+    if (pad == ' ')
+        for (; width > n_text + sign; width--)
+            p[out++] = ' ';
+    if (sign)
+        p[out++] = '-';
+    if (pad == '0')
+        for (; width > n_text + sign; width--)
+            p[out++] = '0';
+    memcpy(p + out, text + len, n_text);
+    out_buffer.len += out + n_text;
+}
+
+/* %04d-%02d-%02d %02d:%02d:%07.4f */
+static void out_date(int years, int months, int days, int hours,
+        int minutes, double seconds)
+{
+    out_int(years, 4);
+    out_char('-');
+    out_int(months, 2);
+    out_char('-');
+    out_int(days, 2);
+    out_char(' ');
+    out_int(hours, 2);
+    out_char(':');
+    out_int(minutes, 2);
+    out_char(':');
+    out_fixed(seconds, 7, 4, '0');
+}
+
+/* time zone of a utc offset in seconds, +HH or +HH:MM */
+static void out_zone(long utc_offset)
+{
+    long minutes = labs(utc_offset)/60;
+    out_char(utc_offset < 0 ? '-' : '+');
+    out_int(minutes/60, 2);
+    if (minutes % 60 != 0)
+    {
+        out_char(':');
+        out_int(minutes % 60, 2);
+    }
 }
 
 void print_ephem_data(struct ephem_data *data, int ut_time,
-        int csv, int verbose, int tz)
+        int csv, int verbose, int tz, long utc_offset)
 {
     char delimit = ' ';
     if (csv)
         delimit = ',';
 
-    struct ln_date date;
     if (!csv)
-        printf("%9s: ", data->label);
+        out_printf("%9s: ", data->label);
     if (ut_time == 1)
     {
-        printf("%04d-%02d-%02d %02d:%02d:%07.4f", 
-                (data->date).years, (data->date).months, (data->date).days,
-                (data->date).hours, (data->date).minutes, (data->date).seconds);
+        const struct ln_date *date = ephem_data_date(data);
+        out_date(date->years, date->months, date->days, date->hours,
+                date->minutes, date->seconds);
         if (tz)
-            printf("+00");
-        printf("%c", delimit);
+            out_str("+00");
+        out_char(delimit);
     }
     else
     {
-        struct ln_zonedate mst;
-        ln_date_to_zonedate(&(data->date), &mst, -7*3600);
-        printf("%04d-%02d-%02d %02d:%02d:%07.4f", 
-                mst.years, mst.months, mst.days,
-                mst.hours, mst.minutes, mst.seconds);
+        struct ln_date local;
+        ephem_data_local_date(data, utc_offset, &local);
+        out_date(local.years, local.months, local.days, local.hours,
+                local.minutes, local.seconds);
         if (tz)
-            printf("-07");
-        printf("%c", delimit);
+            out_zone(utc_offset);
+        out_char(delimit);
     }
 
     if (csv)
     {
         /* setting width puts leading space in the output */
-        printf("%.4f%c", data->moon_illum, delimit);
-        printf("%.4f", data->moon_alt);
+        out_fixed(data->moon_illum, 0, 4, ' ');
+        out_char(delimit);
+        out_fixed(data->moon_alt, 0, 4, ' ');
     }
     else
     {
-        printf("(");
-        printf("%7.4f%c", data->moon_illum, delimit);
-        printf("%9.4f", data->moon_alt);
+        out_char('(');
+        out_fixed(data->moon_illum, 7, 4, ' ');
+        out_char(delimit);
+        out_fixed(data->moon_alt, 9, 4, ' ');
     }
 
     if (!csv)
-        printf(")");
+        out_char(')');
 
     if (verbose)
-        printf(" jd: %f", data->jd);
+    {
+        out_str(" jd: ");
+        out_fixed(data->jd, 0, 6, ' ');
+    }
     /* don't print newline when in csv mode, calling function
        will do that */
     if (!csv)
-        printf("\n");
+        out_end_line();
+}
+
+/* the four events of a night as csv fields, without the newline */
+void print_csv_fields(struct ephem_data *sun_set,
+        struct ephem_data *sun_rise, struct ephem_data *moon_set,
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset)
+{
+    print_ephem_data(sun_set, ut_time, 1, 0, tz, utc_offset);
+    out_char(',');
+    print_ephem_data(sun_rise, ut_time, 1, 0, tz, utc_offset);
+    out_char(',');
+    print_ephem_data(moon_set, ut_time, 1, 0, tz, utc_offset);
+    out_char(',');
+    print_ephem_data(moon_rise, ut_time, 1, 0, tz, utc_offset);
 }
 
 void print_csv(struct ephem_data *sun_set,
         struct ephem_data *sun_rise, struct ephem_data *moon_set,
-        struct ephem_data *moon_rise, int ut_time, int tz)
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset)
 {
-    print_ephem_data(sun_set, ut_time, 1, 0, tz);
-    printf(",");
-    print_ephem_data(sun_rise, ut_time, 1, 0, tz);
-    printf(",");
-    print_ephem_data(moon_set, ut_time, 1, 0, tz);
-    printf(",");
-    print_ephem_data(moon_rise, ut_time, 1, 0, tz);
-    printf("\n");
+    print_csv_fields(sun_set, sun_rise, moon_set, moon_rise, ut_time, tz,
+            utc_offset);
+    out_end_line();
 }
         
+/* one night as a binary table record */
+void print_binary(const struct ephem_night *night, int status)
+{
+    static double flushed;
+    struct ephem_table_record record;
+    ephem_table_record_from_night(night, status, &record);
+    out_bytes(&record, sizeof(record));
+    double now = monotonic_seconds();
+    if (now - flushed >= BINARY_FLUSH_SECONDS)
+    {
+        out_flush();
+        flushed = now;
+    }
+}
+
+/* moon series of night at site, see --moon-series */
+void print_series(const struct ephem_night *night, int status,
+        double mjd, const struct vnight_site *site)
+{
+    struct moon_series_night record;
+    memset(&record, 0, sizeof(record));
+    record.mjd = mjd;
+    moon_series_span(night, status, series_step, &record.start_jd,
+            &record.samples);
+
+    /* a night is less than a day and the step at least a minute */
+    struct moon_sample series[1442];
+    struct ln_lnlat_posn observer;
+    observer.lat = site->latitude;
+    observer.lng = site->longitude;
+    if (get_moon_series(record.start_jd, series_step, record.samples,
+                &observer, series) != VNIGHT_OK)
+        record.samples = 0;
+    record.status = status;
+
+    out_bytes(&record, sizeof(record));
+    out_bytes(series, record.samples*sizeof(series[0]));
+}
+
 void print_ordered(struct ephem_data *sun_set,
         struct ephem_data *sun_rise, struct ephem_data *moon_set,
-        struct ephem_data *moon_rise, int ut_time, int tz)
+        struct ephem_data *moon_rise, int ut_time, int tz, long utc_offset)
 {
     struct ephem_data d[4] = {*sun_set, *sun_rise, *moon_set, *moon_rise};
     qsort(d, 4, sizeof(struct ephem_data), ephem_compar);
     for (int i = 0; i < 4; i++)
-        print_ephem_data(&d[i], ut_time, 0, 1, tz);
+        print_ephem_data(&d[i], ut_time, 0, 1, tz, utc_offset);
+}
+
+/* compute and print the sun and moon events for one UT date at every
+   site, see compute_nights */
+void print_nights(struct night_ephemeris *eph, struct night_sequence *seqs,
+        unsigned long year, unsigned long month, unsigned long day,
+        int binary, int csv, int ut_time, int tz)
+{
+    if (window_mode)
+    {
+        print_windows(eph->track, year, month, day, csv, ut_time, tz);
+        return;
+    }
+    if (crossings_mode)
+    {
+        print_crossings(eph->track, year, month, day, csv, ut_time, tz);
+        return;
+    }
+
+    struct ephem_night nights[MAX_SITES];
+    int status[MAX_SITES];
+    compute_nights(eph, seqs, year, month, day, nights, status);
+    for (int k = 0; k < n_sites; k++)
+        print_result(&nights[k], status[k], date_to_mjd(year, month, day),
+                &sites[k], binary, csv, ut_time, tz);
+}
+
+/* compute and print the window of one UT date at every site, like
+   print_nights */
+void print_windows(struct night_track *track, unsigned long year,
+        unsigned long month, unsigned long day, int csv, int ut_time,
+        int tz)
+{
+    for (int k = 0; k < n_sites; k++)
+    {
+        struct night_context ctx;
+        if (init_night_context_site(&ctx, &sites[k], year, month, day)
+                != VNIGHT_OK)
+        {
+            fprintf(stderr, "%s: Invalid date %04lu-%02lu-%02lu.\n", pname,
+                    year, month, day);
+            exit(EXIT_FAILURE);
+        }
+
+        struct ephem_night night;
+        struct night_window window;
+        int status = get_night_window_roots(track, &ctx, &night, &window);
+        /* the moon of the window is found however the UT day goes */
+        warn_status(status & ~VNIGHT_MOON_CIRCUMPOLAR);
+        if (status & VNIGHT_OUT_OF_RANGE)
+            fprintf(stderr, "%s: Warning no sun rise after sun set\n",
+                    pname);
+        VNIGHT_TIMER_START(VNIGHT_TIME_OUTPUT);
+        print_window(&window, &sites[k], csv, ut_time, tz);
+        VNIGHT_TIMER_STOP(VNIGHT_TIME_OUTPUT);
+    }
+}
+
+/* compute one UT date at every site with --roots and print each night
+   followed by every horizon crossing of the day, like print_nights */
+void print_crossings(struct night_track *track, unsigned long year,
+        unsigned long month, unsigned long day, int csv, int ut_time,
+        int tz)
+{
+    static const char *csv_events[VNIGHT_EVENTS] = {"sun_set", "sun_rise",
+        "moon_set", "moon_rise"};
+
+    for (int k = 0; k < n_sites; k++)
+    {
+        struct night_context ctx;
+        if (init_night_context_site(&ctx, &sites[k], year, month, day)
+                != VNIGHT_OK)
+        {
+            fprintf(stderr, "%s: Invalid date %04lu-%02lu-%02lu.\n", pname,
+                    year, month, day);
+            exit(EXIT_FAILURE);
+        }
+
+        struct ephem_night night;
+        struct night_crossings crossings;
+        int status = get_night_ephem_roots(track, &ctx, &night, &crossings);
+        warn_status(status);
+
+        VNIGHT_TIMER_START(VNIGHT_TIME_OUTPUT);
+        long utc_offset = sites[k].utc_offset;
+        if (n_sites > 1)
+            out_printf(csv ? "%s," : "Site: %s\n", sites[k].name);
+        if (csv)
+        {
+            print_csv_fields(&night.sun_set, &night.sun_rise,
+                    &night.moon_set, &night.moon_rise, ut_time, tz,
+                    utc_offset);
+            out_printf(",%d", crossings.n);
+        }
+        else
+            print_ordered(&night.sun_set, &night.sun_rise, &night.moon_set,
+                    &night.moon_rise, ut_time, tz, utc_offset);
+
+        for (int i = 0; i < crossings.n; i++)
+        {
+            struct ephem_data data;
+            memset(&data, 0, sizeof(data));
+            data.jd = crossings.crossing[i].jd;
+            struct ln_date date;
+            if (ut_time)
+                date = *ephem_data_date(&data);
+            else
+                ephem_data_local_date(&data, utc_offset, &date);
+            int event = crossings.crossing[i].event;
+
+            if (csv)
+                out_char(',');
+            else
+                out_printf(" Crossing: %-9s ", vnight_event_label(event));
+            out_date(date.years, date.months, date.days, date.hours,
+                    date.minutes, date.seconds);
+            if (tz && ut_time)
+                out_str("+00");
+            else if (tz)
+                out_zone(utc_offset);
+            if (csv)
+            {
+                out_char(',');
+                out_str(csv_events[event]);
+            }
+            else
+            {
+                out_str(" jd: ");
+                out_fixed(data.jd, 0, 6, ' ');
+                out_end_line();
+            }
+        }
+        if (csv)
+            out_end_line();
+        VNIGHT_TIMER_STOP(VNIGHT_TIME_OUTPUT);
+    }
+}
+
+/* print the window of a night at site, in time order */
+void print_window(struct night_window *window,
+        const struct vnight_site *site, int csv, int ut_time, int tz)
+{
+    if (n_sites > 1)
+        out_printf(csv ? "%s," : "Site: %s\n", site->name);
+
+    if (!csv)
+    {
+        print_ephem_data(&window->sun_set, ut_time, 0, 1, tz,
+                site->utc_offset);
+        for (int i = 0; i < window->n_moon; i++)
+            print_ephem_data(&window->moon[i], ut_time, 0, 1, tz,
+                    site->utc_offset);
+        print_ephem_data(&window->sun_rise, ut_time, 0, 1, tz,
+                site->utc_offset);
+        return;
+    }
+
+    print_ephem_data(&window->sun_set, ut_time, 1, 0, tz, site->utc_offset);
+    out_char(',');
+    print_ephem_data(&window->sun_rise, ut_time, 1, 0, tz, site->utc_offset);
+    out_printf(",%d", window->n_moon);
+    for (int i = 0; i < window->n_moon; i++)
+    {
+        out_char(',');
+        print_ephem_data(&window->moon[i], ut_time, 1, 0, tz,
+                site->utc_offset);
+        out_str(strcmp(window->moon[i].label, "Moon Rise") == 0 ?
+                ",rise" : ",set");
+    }
+    out_end_line();
+}
+
+/* print one computed night at site. the site is named when there is more
+   than one. */
+void print_result(struct ephem_night *night, int status, double mjd,
+        const struct vnight_site *site, int binary, int csv, int ut_time,
+        int tz)
+{
+    VNIGHT_TIMER_START(VNIGHT_TIME_OUTPUT);
+    format_result(night, status, mjd, site, binary, csv, ut_time, tz);
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_OUTPUT);
+}
+
+/* print_result, without the output timer */
+void format_result(struct ephem_night *night, int status, double mjd,
+        const struct vnight_site *site, int binary, int csv, int ut_time,
+        int tz)
+{
+    if (binary)
+    {
+        print_binary(night, status);
+        return;
+    }
+    if (series_step > 0.)
+    {
+        print_series(night, status, mjd, site);
+        return;
+    }
+
+    if (n_sites > 1)
+        out_printf(csv ? "%s," : "Site: %s\n", site->name);
+    if (csv)
+        print_csv(&night->sun_set, &night->sun_rise, &night->moon_set,
+                &night->moon_rise, ut_time, tz, site->utc_offset);
+    else
+        print_ordered(&night->sun_set, &night->sun_rise, &night->moon_set,
+                &night->moon_rise, ut_time, tz, site->utc_offset);
 }
 
 int ephem_compar(const void *a, const void *b)
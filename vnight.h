@@ -0,0 +1,744 @@
+#ifndef VNIGHT_H
+#define VNIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libnova/ln_types.h"
+
+/* libvnight: sun and moon rise/set times for VERITAS observing nights.
+
+   routines in this library never exit or print. errors are returned as one
+   of the status codes below so that the calling program (vnight, a
+   scheduler, or python through ctypes) decides what to do with them. */
+
+/* latitude and longitude used in software/offline/dqm/cgi-bin/skysurvey/
+   db_scheduler/include/VScheduler.h */
+extern const double veritas_latitude;
+extern const double veritas_longitude;
+
+/* angles of sun relative to horizon used to define VERITAS twilight. defined
+   in software/offline/dqm/cgi-bin/skysurvey/db_scheduler/src/printRiseSet.cpp
+*/
+extern const double horizon_angle_begin;
+extern const double horizon_angle_end;
+
+/* an observing site and the sun altitudes that bound its observing night.
+   everything in libvnight that takes a site defaults to veritas_site. */
+struct vnight_site
+{
+    char name[32];
+    double latitude; /* degrees, north positive */
+    double longitude; /* degrees, east positive */
+    double horizon_begin; /* sun altitude at the end of evening twilight */
+    double horizon_end; /* sun altitude at the start of morning twilight */
+    long utc_offset; /* offset of local time from UT in seconds */
+};
+
+/* VERITAS with the constants above. local time is MST. */
+extern const struct vnight_site veritas_site;
+
+/* read a site file, vnight_site.c. the file has one "key = value" per
+   line, '#' starts a comment. keys are name, latitude, longitude,
+   horizon_begin, horizon_end (degrees) and utc_offset (hours). keys that
+   are not given keep their veritas_site values. */
+int vnight_site_read(const char *path, struct vnight_site *site);
+
+/* status codes returned by library routines. they are bit flags so that
+   get_night_ephem can report a moon and a sun failure for the same date. */
+enum vnight_status
+{
+    VNIGHT_OK               = 0,
+    VNIGHT_MOON_CIRCUMPOLAR = 1, /* moon above or below horizon all day */
+    VNIGHT_SUN_CIRCUMPOLAR  = 2, /* sun above or below twilight angle */
+    VNIGHT_BAD_DATE         = 4, /* calendar date could not be converted */
+    VNIGHT_FILE_ERROR       = 8, /* file could not be read or written */
+    VNIGHT_NO_MEMORY        = 16, /* allocation failed */
+    VNIGHT_OUT_OF_RANGE     = 32, /* date not covered by a table or fit */
+    VNIGHT_STALE_TABLE      = 64, /* table made for another site or angles */
+    VNIGHT_NOT_CACHED       = 128 /* night not computed into a cache table */
+};
+
+/* structure to hold a sun rise, sun set, moon rise, moon set event time.
+   fraction of the moon's disk that is illuminated at the time of the
+   event is also stored. if the moon is below the horizon, moon_illum
+   is < 0.
+ */
+struct ephem_data
+{
+    /* if used for a sun event, moon_illum is moon fraction at the
+       time stored here. if the moon is not above the horizon, then
+       fraction is < 0. moon_alt is the altitude of the moon on date. */
+    /* UT date of jd. the solvers only set jd and clear date.months,
+       ephem_data_date makes the date from it when output needs it. */
+    struct ln_date date;
+    double moon_illum; /* fraction of the moon that is illuminated [0 - 1] */
+    double moon_alt; /* altitude of moon */
+    double jd; /* julian date */
+    char label[16];
+};
+
+/* UT calendar date of an event, made on first use and kept in data until
+   its jd is set again */
+const struct ln_date *ephem_data_date(struct ephem_data *data);
+/* calendar date of an event utc_offset seconds from UT, into local. it
+   is made each time, output prints it once */
+void ephem_data_local_date(struct ephem_data *data, long utc_offset,
+        struct ln_date *local);
+
+/* the four events that describe one UT date */
+struct ephem_night
+{
+    struct ephem_data sun_set;
+    struct ephem_data sun_rise;
+    struct ephem_data moon_set;
+    struct ephem_data moon_rise;
+};
+
+/* number of sun positions kept for a night. the rise/set solver evaluates
+   the body at the same few julian dates for each twilight angle. */
+#define VNIGHT_POSITION_CACHE_SIZE 4
+
+/* equatorial positions of a body already computed, keyed by julian date */
+struct position_cache
+{
+    int n; /* number of entries in use */
+    int next; /* entry replaced on the next miss once the cache is full */
+    double jd[VNIGHT_POSITION_CACHE_SIZE];
+    struct ln_equ_posn posn[VNIGHT_POSITION_CACHE_SIZE];
+};
+
+/* geocentric sun and moon positions of a UT date at 0h UT of the day
+   before, the day of, and the day after. these are the samples both the
+   libnova rst routines and the sequential solver interpolate, and they do
+   not depend on the observer, so one is computed per date and shared by
+   the night contexts of every site instead of each site evaluating the
+   theories again. */
+struct lunar_cheb;
+struct night_track;
+
+struct night_ephemeris
+{
+    int valid; /* 0 until the first update */
+    double day0; /* 0h UT of the date, julian date of sun[1] and moon[1] */
+    const struct lunar_cheb *cheb; /* fit the moon positions came from */
+    struct ln_equ_posn sun[3];
+    struct ln_equ_posn moon[3];
+    double sidereal; /* apparent sidereal time at day0, degrees */
+    /* when set by the caller, get_night_ephem_sites solves every site
+       with get_night_ephem_roots on this track instead */
+    struct night_track *track;
+};
+
+void init_night_ephemeris(struct night_ephemeris *eph);
+/* move eph to the UT date at mjd. moving to the next date computes one new
+   sun and one new moon position. */
+void update_night_ephemeris(struct night_ephemeris *eph, double mjd);
+
+/* everything about a UT date that does not depend on the event being
+   solved for. it is filled once per night by init_night_context and shared
+   by the sun and moon solvers. */
+struct night_context
+{
+    unsigned long year;
+    unsigned long month;
+    unsigned long day;
+    double mjd; /* modified julian date at 0h UT */
+    double jd; /* date given to the libnova rst routines, mjd + 2400000 */
+    const struct vnight_site *site;
+    struct ln_lnlat_posn observer;
+    struct position_cache sun;
+    /* positions shared with other sites, NULL if the context computes its
+       own. set by the caller after init_night_context, it is only used
+       when it is for the same date. */
+    const struct night_ephemeris *ephem;
+};
+
+/* context of a night at VERITAS, or at site. the site is not copied and
+   must outlive the context. */
+int init_night_context(struct night_context *ctx, unsigned long year,
+        unsigned long month, unsigned long day);
+int init_night_context_site(struct night_context *ctx,
+        const struct vnight_site *site, unsigned long year,
+        unsigned long month, unsigned long day);
+int get_moon_rise_set_ctx(struct night_context *ctx, struct ephem_data *rise,
+        struct ephem_data *set);
+int get_sun_rise_set_ctx(struct night_context *ctx, struct ephem_data *rise,
+        struct ephem_data *set);
+int get_night_ephem_ctx(struct night_context *ctx, struct ephem_night *night);
+
+/* state the sequential solver carries from one night to the next. positions
+   are kept at 0h UT of the day before, the day of, and the day after the
+   last night solved, so consecutive nights only need one new sun and one
+   new moon position. event times of the last two nights seed the next
+   night's solve. */
+struct night_sequence
+{
+    int nights; /* consecutive nights solved so far, 0 after a reset */
+    double day0; /* 0h UT of the last night solved */
+    struct ln_equ_posn sun[3];
+    struct ln_equ_posn moon[3];
+    /* event jds of the last two nights, indexed by enum vnight_event */
+    double prev[4];
+    double prev2[4];
+    unsigned long seeded; /* events solved from a seed */
+    unsigned long fallbacks; /* events that needed the full libnova solve */
+};
+
+/* events in the order they are kept in struct night_sequence */
+enum vnight_event
+{
+    VNIGHT_SUN_SET = 0,
+    VNIGHT_SUN_RISE,
+    VNIGHT_MOON_SET,
+    VNIGHT_MOON_RISE,
+    VNIGHT_EVENTS /* number of events */
+};
+
+void init_night_sequence(struct night_sequence *seq);
+/* like get_night_ephem_ctx, but seeds each event from the previous nights
+   in seq when ctx is the night after the last one solved. an event that
+   does not converge inside the UT day is solved with the full libnova
+   method instead. results agree with get_night_ephem_ctx to seconds, not
+   bit for bit. */
+int get_night_ephem_seq(struct night_sequence *seq, struct night_context *ctx,
+        struct ephem_night *night);
+
+/* compute a UT date for each of n_sites sites with the positions in eph,
+   which is moved to the date first. seqs is NULL for get_night_ephem_ctx
+   or one sequence per site for get_night_ephem_seq, and is not used when
+   eph has a track. nights and status
+   have n_sites entries, the return value is the bitwise or of status.
+   the geocentric positions are computed once for all sites, what each
+   site still pays for is its own rst iteration and the moon at its
+   event times. */
+int get_night_ephem_sites(struct night_ephemeris *eph,
+        const struct vnight_site *sites, int n_sites,
+        struct night_sequence *seqs, unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *nights, int *status);
+
+/* exact horizon crossings, vnight_roots.c. the sun and moon are kept at
+   nodes every VNIGHT_TRACK_STEP days from the day before a UT date to
+   three days after it, and altitudes in between come from cubic
+   interpolation of the positions. crossings are bracketed by sampling
+   the altitude VNIGHT_ROOTS_SAMPLES_PER_DAY times a day and refined with a
+   newton iteration that falls back to bisection whenever a step leaves
+   its bracket. */
+#define VNIGHT_TRACK_STEP 0.5
+#define VNIGHT_TRACK_NODES 9
+#define VNIGHT_ROOTS_SAMPLES_PER_DAY 48
+#define VNIGHT_MAX_CROSSINGS 8
+
+struct track_nodes
+{
+    double ra[VNIGHT_TRACK_NODES]; /* degrees, continuous through 0h */
+    double dec[VNIGHT_TRACK_NODES];
+};
+
+struct night_track
+{
+    int valid; /* 0 until the first update */
+    double day0; /* 0h UT of the date */
+    double first; /* julian date of the first node, day0 - 1 */
+    const struct lunar_cheb *cheb; /* fit the moon nodes came from */
+    double sidereal; /* apparent sidereal time at day0, degrees */
+    struct track_nodes sun;
+    struct track_nodes moon;
+    double moon_illum[VNIGHT_TRACK_NODES];
+};
+
+/* one horizon crossing. sun sets are at horizon_begin of the site and
+   sun rises at horizon_end, as for struct ephem_night. */
+struct vnight_crossing
+{
+    double jd;
+    int event; /* enum vnight_event */
+};
+
+struct night_crossings
+{
+    int n;
+    struct vnight_crossing crossing[VNIGHT_MAX_CROSSINGS]; /* in time order */
+};
+
+void init_night_track(struct night_track *track);
+/* move track to the UT date at mjd. moving a day forward computes two new
+   nodes of each body. */
+void update_night_track(struct night_track *track, double mjd);
+/* like get_night_ephem_ctx, with each event the first crossing from 0h UT
+   of the date on. a moon or sun that does not cross in the UT day takes
+   the crossing of the day after, and only one that does not cross in two
+   days is circumpolar, with its events left zero. events differ from
+   the libnova rst method by about the error of its interpolation, a
+   minute or two for the moon, and take the next day's crossing where it
+   has no event in the day. if crossings is not NULL it gets every
+   crossing inside the UT day. the track is moved to the date first and
+   is not tied to one site, so several sites can share it. */
+int get_night_ephem_roots(struct night_track *track,
+        struct night_context *ctx, struct ephem_night *night,
+        struct night_crossings *crossings);
+
+/* the dark window of a night, from its sun set to the first sun rise
+   after it, with every moon rise and set inside. a night can have no
+   moon event, one, or a set and a rise, neither of which the four events
+   of struct ephem_night can hold. */
+#define VNIGHT_MAX_WINDOW_EVENTS 4
+
+struct night_window
+{
+    struct ephem_data sun_set;
+    struct ephem_data sun_rise; /* first rise after sun_set */
+    int moon_up; /* moon above the horizon at sun_set */
+    int n_moon;
+    struct ephem_data moon[VNIGHT_MAX_WINDOW_EVENTS]; /* in time order */
+};
+
+/* get_night_ephem_roots and the window of the night. the moon samples of
+   the night are reused for the window and only the part of the next day
+   the window reaches into is sampled. a window is left empty, with n_moon
+   0 and its sun events zero, when the sun is circumpolar. */
+int get_night_window_roots(struct night_track *track,
+        struct night_context *ctx, struct ephem_night *night,
+        struct night_window *window);
+
+/* lunar chebyshev cache, vnight_cheb.c. segments are VNIGHT_CHEB_SPAN days
+   long with VNIGHT_CHEB_ORDER coefficients for each of ra, dec, distance,
+   and illuminated fraction. */
+#define VNIGHT_CHEB_SPAN 8.
+#define VNIGHT_CHEB_ORDER 24
+
+struct lunar_cheb
+{
+    double start; /* jd at the start of the first segment */
+    double span; /* days per segment */
+    int order; /* coefficients per quantity per segment */
+    int nsegments;
+    double *coeffs;
+};
+
+/* largest differences between a fit and the direct libnova routines */
+struct lunar_cheb_error
+{
+    double ra; /* arcsec on the sky */
+    double dec; /* arcsec */
+    double dist; /* km */
+    double illum; /* fraction of the disk */
+    unsigned long samples;
+};
+
+/* fit the moon from start_jd to at least stop_jd */
+int lunar_cheb_build(struct lunar_cheb *cheb, double start_jd, double stop_jd);
+/* evaluate a fit, any of posn, dist, illum may be NULL. returns
+   VNIGHT_OUT_OF_RANGE if jd is outside the fit. */
+int lunar_cheb_eval(const struct lunar_cheb *cheb, double jd,
+        struct ln_equ_posn *posn, double *dist, double *illum);
+int lunar_cheb_covers(const struct lunar_cheb *cheb, double start_jd,
+        double stop_jd);
+int lunar_cheb_write(const struct lunar_cheb *cheb, const char *path);
+int lunar_cheb_read(struct lunar_cheb *cheb, const char *path);
+void lunar_cheb_free(struct lunar_cheb *cheb);
+/* compare a fit to libnova every step days over the whole fit */
+void lunar_cheb_validate(const struct lunar_cheb *cheb, double step,
+        struct lunar_cheb_error *err);
+
+/* make every moon evaluation in libvnight use cheb where it covers the
+   date, NULL goes back to the full lunar theory. the fit is only read, so
+   it must stay allocated while it is in use. */
+void vnight_set_lunar_cheb(const struct lunar_cheb *cheb);
+const struct lunar_cheb *vnight_get_lunar_cheb(void);
+/* moon position and illuminated fraction from the active fit, or from
+   libnova when there is none */
+void vnight_moon_equ_coords(double jd, struct ln_equ_posn *posn);
+double vnight_moon_disk(double jd);
+
+/* binary night table, vnight_table.c. a table is a header followed by one
+   fixed size record per night starting at start_mjd, so night i is found
+   by offset alone. fields are in host byte order, which is little-endian
+   on every machine we schedule from. vnight --binary streams the same
+   layout to stdout. */
+#define VNIGHT_TABLE_MAGIC "VNTABLE1"
+
+struct ephem_table_header
+{
+    char magic[8];
+    uint32_t header_size; /* sizeof(struct ephem_table_header) */
+    uint32_t record_size; /* sizeof(struct ephem_table_record) */
+    int32_t nights;
+    int32_t reserved;
+    double start_mjd; /* UT date of the first record */
+    /* site and twilight angles the table was computed for */
+    double latitude;
+    double longitude;
+    double horizon_begin;
+    double horizon_end;
+};
+
+struct ephem_table_event
+{
+    double jd;
+    double moon_illum;
+    double moon_alt;
+};
+
+struct ephem_table_record
+{
+    struct ephem_table_event event[4]; /* indexed by enum vnight_event */
+    int32_t status; /* status the night was computed with */
+    int32_t reserved;
+};
+
+/* a table mapped into memory */
+struct ephem_table
+{
+    const struct ephem_table_header *header;
+    const struct ephem_table_record *records;
+    size_t size;
+};
+
+void ephem_table_record_from_night(const struct ephem_night *night,
+        int status, struct ephem_table_record *record);
+/* the night a record was made from, as far as a record keeps it */
+void ephem_night_from_table_record(const struct ephem_table_record *record,
+        struct ephem_night *night);
+/* header of a table of nights at site from start_mjd */
+void ephem_table_header_init(struct ephem_table_header *header,
+        const struct vnight_site *site, double start_mjd, int32_t nights);
+int ephem_table_write(const char *path, const struct vnight_site *site,
+        double start_mjd, int32_t nights,
+        const struct ephem_table_record *records);
+/* map a table read-only. returns VNIGHT_STALE_TABLE, with the table left
+   unmapped, if it was made for a different site or twilight angles. */
+int ephem_table_map(const char *path, const struct vnight_site *site,
+        struct ephem_table *table);
+void ephem_table_unmap(struct ephem_table *table);
+/* record for the UT date at mjd, NULL if the table does not have it */
+const struct ephem_table_record *ephem_table_night(
+        const struct ephem_table *table, double mjd);
+
+/* computed nights in bulk, vnight_batch.c. a batch keeps the events of
+   each night as arrays of julian dates and single precision moon
+   illumination and altitude, indexed by night*VNIGHT_EVENTS + event, 16
+   bytes an event against the 72 of struct ephem_data. the illumination
+   and altitude are kept to the 4 decimals vnight prints. dates and labels
+   follow from the julian date and the event, so they are only made when
+   a night is taken out to be printed. */
+struct ephem_batch
+{
+    size_t nights;
+    double *jd;
+    float *moon_illum;
+    float *moon_alt;
+    int32_t *status; /* per night */
+};
+
+/* label of an enum vnight_event, "Sun Set" and so on */
+const char *vnight_event_label(int event);
+/* bytes of memory a batch of nights needs */
+size_t ephem_batch_size(size_t nights);
+/* lay a batch of nights out in memory of ephem_batch_size(nights) bytes */
+void ephem_batch_init(struct ephem_batch *batch, void *memory,
+        size_t nights);
+void ephem_batch_put(struct ephem_batch *batch, size_t i,
+        const struct ephem_night *night, int status);
+/* night i, with its dates and labels, and its status */
+int ephem_batch_get(const struct ephem_batch *batch, size_t i,
+        struct ephem_night *night);
+void ephem_batch_record(const struct ephem_batch *batch, size_t i,
+        struct ephem_table_record *record);
+
+/* cache of computed nights, vnight_cache.c. a cache directory holds a
+   directory of night tables per key, and a table per UT year in it,
+   DIR/KEY/YEAR.vnt. the key is made of VNIGHT_CACHE_VERSION, the
+   version of the libnova linked in, the solver and the site coordinates
+   and twilight angles, so a table is never reused for results computed
+   differently. nights of a year that were not computed yet have status
+   VNIGHT_NOT_CACHED. */
+#define VNIGHT_CACHE_VERSION 2 /* bump when a change alters any result */
+#define VNIGHT_CACHE_KEY_SIZE 160 /* room for any key */
+
+/* name of the directory the tables of site and solver are kept in, at
+   most size bytes including the terminating nul. characters of the
+   libnova version other than letters, digits, '.', '+' and '-' are
+   written as '-'. */
+int ephem_cache_key(char *key, size_t size, const struct vnight_site *site,
+        const char *solver);
+int ephem_cache_path(char *path, size_t size, const char *dir,
+        const struct vnight_site *site, const char *solver, int year);
+/* records of every night of year into a malloced *records, those not in
+   the cache marked VNIGHT_NOT_CACHED. a missing or stale table reads as
+   an empty one. */
+int ephem_cache_load(const char *dir, const struct vnight_site *site,
+        const char *solver, int year, double *start_mjd, int32_t *nights,
+        struct ephem_table_record **records);
+/* replace the table of year with records, creating directories as
+   needed. readers never see a partly written table. */
+int ephem_cache_store(const char *dir, const struct vnight_site *site,
+        const char *solver, int year, double start_mjd, int32_t nights,
+        const struct ephem_table_record *records);
+
+/* computed nights kept in memory, vnight_server.c. at most capacity
+   nights are kept, the least recently used is dropped for a new one. */
+struct night_lru_entry
+{
+    double mjd;
+    struct ephem_table_record record;
+    int32_t prev, next; /* toward the most and the least recently used */
+    int32_t chain; /* next entry in the same hash bucket */
+};
+
+struct night_lru
+{
+    size_t capacity;
+    size_t n;
+    struct night_lru_entry *entries;
+    int32_t *buckets; /* first entry of each bucket, -1 if none */
+    size_t n_buckets; /* a power of two */
+    int32_t head, tail; /* most and least recently used, -1 if empty */
+};
+
+int night_lru_init(struct night_lru *lru, size_t capacity);
+void night_lru_free(struct night_lru *lru);
+/* copy the night at mjd to record and make it the most recently used.
+   returns 1 if it is there, 0 if not. */
+int night_lru_get(struct night_lru *lru, double mjd,
+        struct ephem_table_record *record);
+void night_lru_put(struct night_lru *lru, double mjd,
+        const struct ephem_table_record *record);
+
+/* vnight --serve protocol, over a unix stream socket. a client sends a
+   request header and its queries, each a range of nights, and the server
+   answers with a reply header and a struct ephem_table_record per night
+   of every query, in order. a connection can carry any number of
+   requests. all fields are in the byte order of the host. */
+#define VNIGHT_REQUEST_MAGIC "VNQ1"
+#define VNIGHT_REPLY_MAGIC "VNR1"
+#define VNIGHT_SERVER_MAX_QUERIES 4096
+#define VNIGHT_SERVER_MAX_NIGHTS (1 << 20) /* per request */
+
+struct vnight_request_header
+{
+    char magic[4];
+    uint32_t queries;
+};
+
+struct vnight_query
+{
+    double start_mjd; /* UT date of the first night */
+    int32_t nights;
+    int32_t reserved;
+};
+
+struct vnight_reply_header
+{
+    char magic[4];
+    int32_t status; /* VNIGHT_OK, or why no records follow */
+    uint32_t records;
+    uint32_t reserved;
+};
+
+/* a server for site. nights it has not kept in lru are solved with eph
+   and, if it is not NULL, seq. serve returns when *stop is set, from a
+   signal handler for instance, or VNIGHT_FILE_ERROR if the socket could
+   not be set up. an existing socket at path is replaced. */
+int vnight_serve(const char *path, const struct vnight_site *site,
+        struct night_ephemeris *eph, struct night_sequence *seq,
+        struct night_lru *lru, volatile int *stop);
+/* send queries to the server at path and read the records of all of them
+   into a malloced *records */
+int vnight_query(const char *path, const struct vnight_query *queries,
+        uint32_t n_queries, struct ephem_table_record **records,
+        uint32_t *n_records);
+
+/* moon time series through a night, vnight_series.c. samples run every
+   step days from the sun set to the next sun rise. the moon and sun are
+   evaluated every VNIGHT_SERIES_NODE_STEP days and interpolated in
+   between, so a night costs a handful of theory calls whatever the step.
+   vnight --moon-series streams a header, then for each night a
+   struct moon_series_night followed by its samples. */
+#define VNIGHT_SERIES_MAGIC "VNSERIE1"
+#define VNIGHT_SERIES_NODE_STEP (1./8.)
+
+struct moon_series_header
+{
+    char magic[8];
+    uint32_t header_size; /* sizeof(struct moon_series_header) */
+    uint32_t night_size; /* sizeof(struct moon_series_night) */
+    uint32_t sample_size; /* sizeof(struct moon_sample) */
+    int32_t nights;
+    double start_mjd; /* UT date of the first night */
+    double step; /* days between samples */
+    /* site and twilight angles the series was computed for */
+    double latitude;
+    double longitude;
+    double horizon_begin;
+    double horizon_end;
+};
+
+struct moon_series_night
+{
+    double mjd; /* UT date of the night */
+    double start_jd; /* julian date of the first sample, the sun set */
+    int32_t samples; /* struct moon_sample records that follow */
+    int32_t status; /* status the night was computed with */
+};
+
+struct moon_sample
+{
+    float alt; /* moon altitude, degrees */
+    float illum; /* illuminated fraction of the moon's disk */
+    float sun_separation; /* angle between the moon and the sun, degrees */
+};
+
+/* first sample and number of samples of a night, 0 samples if the sun
+   does not reach the twilight angles */
+void moon_series_span(const struct ephem_night *night, int status,
+        double step, double *start_jd, int32_t *samples);
+/* fill series with samples from start_jd. returns VNIGHT_OUT_OF_RANGE if
+   the samples span more than a day. */
+int get_moon_series(double start_jd, double step, int32_t samples,
+        const struct ln_lnlat_posn *observer, struct moon_sample *series);
+void moon_series_header_init(struct moon_series_header *header,
+        const struct vnight_site *site, double start_mjd, int32_t nights,
+        double step);
+
+/* altitude kernel, vnight_altitude.c. for n_targets targets at ra, dec
+   (degrees) seen from latitude, fills row i of sin_alt (or alt, degrees)
+   with the n_times values for the local sidereal times lst (degrees).
+   sin(dec) and cos(dec) are taken once per target and one vectorized sincos
+   once per sidereal time. comparing sin_alt to the sine of an elevation
+   cut skips the asin. returns VNIGHT_NO_MEMORY if the target terms cannot
+   be allocated. */
+int vnight_sin_altitudes(double latitude, const double *ra,
+        const double *dec, size_t n_targets, const double *lst,
+        size_t n_times, double *sin_alt);
+int vnight_altitudes(double latitude, const double *ra, const double *dec,
+        size_t n_targets, const double *lst, size_t n_times, double *alt);
+/* sum of weights[j] over the times lst[j] at which each target is above
+   elevation degrees, into time[i]. nothing of size n_targets*n_times is
+   kept, so this is the one to use for observable hours. */
+int vnight_time_above(double latitude, const double *ra, const double *dec,
+        size_t n_targets, const double *lst, const double *weights,
+        size_t n_times, double elevation, double *time);
+/* "avx2", "neon" or "scalar", the kernel the calls above run on this cpu */
+const char *vnight_altitude_kernel(void);
+
+/* hot path counters and timers, vnight_stats.c. they are only kept when
+   libvnight is compiled with -DVNIGHT_STATS, otherwise the macros below
+   are empty and the hot paths are as without them. the counts are per
+   thread. timers count timestamp counter ticks on x86 and nanoseconds
+   elsewhere, and include anything timed inside them. */
+enum vnight_counter
+{
+    VNIGHT_STAT_NIGHTS,             /* nights solved, one per site */
+    VNIGHT_STAT_SOLAR_POSITIONS,    /* solar theory evaluations */
+    VNIGHT_STAT_LUNAR_POSITIONS,    /* lunar theory or fit evaluations */
+    VNIGHT_STAT_RST_SOLVES,         /* libnova rise/set solutions */
+    VNIGHT_STAT_SEQ_ITERATIONS,     /* newton steps of the sequential solver */
+    VNIGHT_STAT_ROOTS_ITERATIONS,   /* refinement steps of vnight_roots.c */
+    VNIGHT_STAT_POSITION_HITS,      /* sun positions a solve did not redo */
+    VNIGHT_STAT_POSITION_MISSES,
+    VNIGHT_STAT_NIGHT_CACHE_HITS,   /* nights from a cache table or the
+                                       nights a server keeps */
+    VNIGHT_STAT_NIGHT_CACHE_MISSES,
+    VNIGHT_STAT_SEQ_FALLBACKS,      /* sequential events left to libnova */
+    VNIGHT_STAT_NEXT_DAY_EVENTS,    /* roots events taken from the next day */
+    VNIGHT_STAT_MOON_CIRCUMPOLAR,
+    VNIGHT_STAT_SUN_CIRCUMPOLAR,
+    VNIGHT_STAT_COUNTERS
+};
+
+enum vnight_timer
+{
+    VNIGHT_TIME_MOON_RISE_SET,      /* get_moon_rise_set and the same solve
+                                       of the sequential solver */
+    VNIGHT_TIME_SUN_RISE_SET,
+    VNIGHT_TIME_MOON_ALT_ILLUM,
+    VNIGHT_TIME_ROOTS,              /* a night of get_night_ephem_roots */
+    VNIGHT_TIME_OUTPUT,             /* formatting and writing, see vnight.c */
+    VNIGHT_STAT_TIMERS
+};
+
+struct vnight_stats
+{
+    uint64_t count[VNIGHT_STAT_COUNTERS];
+    uint64_t calls[VNIGHT_STAT_TIMERS];
+    uint64_t ticks[VNIGHT_STAT_TIMERS];
+};
+
+extern __thread struct vnight_stats vnight_thread_stats;
+
+/* 1 if libvnight was built with VNIGHT_STATS */
+int vnight_stats_enabled(void);
+/* zero the counts of this thread and start the clock that
+   vnight_ticks_per_second is measured against */
+void vnight_stats_reset(void);
+void vnight_stats_add(struct vnight_stats *sum,
+        const struct vnight_stats *stats);
+/* rate of the timer ticks, measured since the last vnight_stats_reset */
+double vnight_ticks_per_second(void);
+/* names used for the counters and timers in output, e.g. "nights" */
+const char *vnight_counter_name(int counter);
+const char *vnight_timer_name(int timer);
+
+#ifdef VNIGHT_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t vnight_ticks(void)
+{
+    return __rdtsc();
+}
+#else
+#include <time.h>
+static inline uint64_t vnight_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + (uint64_t)ts.tv_nsec;
+}
+#endif
+#define VNIGHT_COUNT(c) (vnight_thread_stats.count[c]++)
+#define VNIGHT_COUNT_N(c, n) (vnight_thread_stats.count[c] += (n))
+/* circumpolar bits of a night's status */
+#define VNIGHT_COUNT_STATUS(s) \
+    (vnight_thread_stats.count[VNIGHT_STAT_MOON_CIRCUMPOLAR] += \
+         ((s) & VNIGHT_MOON_CIRCUMPOLAR) != 0, \
+     vnight_thread_stats.count[VNIGHT_STAT_SUN_CIRCUMPOLAR] += \
+         ((s) & VNIGHT_SUN_CIRCUMPOLAR) != 0)
+/* a timer is started and stopped in the same block */
+#define VNIGHT_TIMER_START(t) uint64_t vnight_timer_##t = vnight_ticks()
+#define VNIGHT_TIMER_STOP(t) \
+    (vnight_thread_stats.calls[t]++, \
+     vnight_thread_stats.ticks[t] += vnight_ticks() - vnight_timer_##t)
+#else
+#define VNIGHT_COUNT(c) ((void)0)
+#define VNIGHT_COUNT_N(c, n) ((void)0)
+#define VNIGHT_COUNT_STATUS(s) ((void)0)
+#define VNIGHT_TIMER_START(t) do {} while (0)
+#define VNIGHT_TIMER_STOP(t) ((void)0)
+#endif
+
+/* the year/month/day versions build a night context for a single call */
+int get_moon_rise_set(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_data *rise, struct ephem_data *set);
+int get_sun_rise_set(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_data *rise, struct ephem_data *set);
+void get_moon_alt_and_illum(double jd, struct ln_lnlat_posn *observer,
+        double *alt, double *illum);
+
+/* compute all four events for a UT date. every event in night is
+   initialized even when a status other than VNIGHT_OK is returned; events
+   that could not be computed have jd = 0. the return value is the bitwise
+   or of the moon and sun status. */
+int get_night_ephem(unsigned long year, unsigned long month,
+        unsigned long day, struct ephem_night *night);
+
+/* modified julian date at 0h UT on the specified date */
+int vnight_date_to_mjd(unsigned long year, unsigned long month,
+        unsigned long day, double *mjd);
+/* calendar date and time of jd */
+void vnight_jd_to_date(double jd, struct ln_date *date);
+
+/* short description of a status code returned by the routines above */
+const char *vnight_strerror(int status);
+
+#endif
@@ -0,0 +1,364 @@
+#include <math.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VNIGHT_ALTITUDE_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VNIGHT_ALTITUDE_NEON
+#endif
+
+#include "vnight.h"
+
+/* altitudes of many targets at many sidereal times. with
+   a = sin(lat) sin(dec), b = cos(lat) cos(dec) cos(ra) and
+   c = cos(lat) cos(dec) sin(ra) for each target,
+
+       sin(alt) = a + b cos(lst) + c sin(lst)
+
+   so the only trig left is one sincos per sidereal time, which is done
+   a block of times at a time with a vectorized polynomial, see
+   sincos_deg. each block is then combined with every target. the AVX2
+   kernel is picked at run time on x86, NEON is always there on aarch64. */
+
+/* sidereal times per block, sincos of a block is kept on the stack */
+#define ALTITUDE_BLOCK 256
+
+/* polynomials of the fdlibm sin and cos kernels on [-pi/4, pi/4] */
+static const double sin_coeffs[6] = {-1.66666666666666324348e-01,
+    8.33333333332248946124e-03, -1.98412698298579493134e-04,
+    2.75573137070700676789e-06, -2.50507602534068634195e-08,
+    1.58969099521155010221e-10};
+static const double cos_coeffs[6] = {4.16666666666666019037e-02,
+    -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+    -2.75573143513906633035e-07, 2.08757232129817482790e-09,
+    -1.13596475577881948265e-11};
+
+static const double deg_to_rad = 1.74532925199432957692e-02;
+
+/* sine and cosine of x degrees. the quadrant is taken off in degrees,
+   where it is exact, and the rest is at most 45 degrees. every kernel
+   below is this function, one lane per time. */
+static void sincos_deg(double x, double *s, double *c)
+{
+    double k = nearbyint(x/90.);
+    double r = (x - 90.*k)*deg_to_rad;
+    double z = r*r;
+
+    double ps = sin_coeffs[5];
+    double pc = cos_coeffs[5];
+    for (int i = 4; i >= 0; i--)
+    {
+        ps = ps*z + sin_coeffs[i];
+        pc = pc*z + cos_coeffs[i];
+    }
+    double sr = r + r*z*ps;
+    double cr = 1. - 0.5*z + z*z*pc;
+
+    long q = (long)k & 3;
+    double sq = (q & 1) ? cr : sr;
+    double cq = (q & 1) ? sr : cr;
+    *s = (q & 2) ? -sq : sq;
+    *c = ((q + 1) & 2) ? -cq : cq;
+}
+
+static void sincos_block_scalar(const double *lst, int n, double *s,
+        double *c)
+{
+    for (int j = 0; j < n; j++)
+        sincos_deg(lst[j], &s[j], &c[j]);
+}
+
+static void combine_block_scalar(double a, double b, double c,
+        const double *cos_lst, const double *sin_lst, int n, double *out)
+{
+    for (int j = 0; j < n; j++)
+        out[j] = a + b*cos_lst[j] + c*sin_lst[j];
+}
+
+#ifdef VNIGHT_ALTITUDE_AVX2
+__attribute__((target("avx2,fma")))
+static void sincos_block_avx2(const double *lst, int n, double *s,
+        double *c)
+{
+    const __m256d ninetieth = _mm256_set1_pd(1./90.);
+    const __m256d ninety = _mm256_set1_pd(90.);
+    const __m256d to_rad = _mm256_set1_pd(deg_to_rad);
+    const __m256d one = _mm256_set1_pd(1.);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d sign = _mm256_set1_pd(-0.);
+    const __m256i one_i = _mm256_set1_epi64x(1);
+    const __m256i two_i = _mm256_set1_epi64x(2);
+
+    int j = 0;
+    for (; j + 4 <= n; j += 4)
+    {
+        __m256d x = _mm256_loadu_pd(&lst[j]);
+        __m256d k = _mm256_round_pd(_mm256_mul_pd(x, ninetieth),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256d r = _mm256_mul_pd(_mm256_fnmadd_pd(ninety, k, x), to_rad);
+        __m256d z = _mm256_mul_pd(r, r);
+
+        __m256d ps = _mm256_set1_pd(sin_coeffs[5]);
+        __m256d pc = _mm256_set1_pd(cos_coeffs[5]);
+        for (int i = 4; i >= 0; i--)
+        {
+            ps = _mm256_fmadd_pd(ps, z, _mm256_set1_pd(sin_coeffs[i]));
+            pc = _mm256_fmadd_pd(pc, z, _mm256_set1_pd(cos_coeffs[i]));
+        }
+        __m256d sr = _mm256_fmadd_pd(_mm256_mul_pd(r, z), ps, r);
+        __m256d cr = _mm256_fmadd_pd(_mm256_mul_pd(z, z), pc,
+                _mm256_fnmadd_pd(half, z, one));
+
+        /* quadrant as 64 bit integers, k is small so the low 32 bits of
+           each lane are enough */
+        __m256i q = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k));
+        __m256d swap = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                    _mm256_and_si256(q, one_i), one_i));
+        __m256d neg_s = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                    _mm256_and_si256(q, two_i), two_i));
+        __m256d neg_c = _mm256_castsi256_pd(_mm256_cmpeq_epi64(
+                    _mm256_and_si256(_mm256_add_epi64(q, one_i), two_i),
+                    two_i));
+        __m256d sq = _mm256_blendv_pd(sr, cr, swap);
+        __m256d cq = _mm256_blendv_pd(cr, sr, swap);
+        _mm256_storeu_pd(&s[j], _mm256_xor_pd(sq,
+                    _mm256_and_pd(neg_s, sign)));
+        _mm256_storeu_pd(&c[j], _mm256_xor_pd(cq,
+                    _mm256_and_pd(neg_c, sign)));
+    }
+    sincos_block_scalar(&lst[j], n - j, &s[j], &c[j]);
+}
+
+__attribute__((target("avx2,fma")))
+static void combine_block_avx2(double a, double b, double c,
+        const double *cos_lst, const double *sin_lst, int n, double *out)
+{
+    const __m256d va = _mm256_set1_pd(a);
+    const __m256d vb = _mm256_set1_pd(b);
+    const __m256d vc = _mm256_set1_pd(c);
+    int j = 0;
+    for (; j + 4 <= n; j += 4)
+    {
+        __m256d v = _mm256_fmadd_pd(vb, _mm256_loadu_pd(&cos_lst[j]), va);
+        v = _mm256_fmadd_pd(vc, _mm256_loadu_pd(&sin_lst[j]), v);
+        _mm256_storeu_pd(&out[j], v);
+    }
+    combine_block_scalar(a, b, c, &cos_lst[j], &sin_lst[j], n - j, &out[j]);
+}
+
+static int have_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+#ifdef VNIGHT_ALTITUDE_NEON
+static void sincos_block_neon(const double *lst, int n, double *s,
+        double *c)
+{
+    const float64x2_t ninetieth = vdupq_n_f64(1./90.);
+    const float64x2_t ninety = vdupq_n_f64(90.);
+    const float64x2_t to_rad = vdupq_n_f64(deg_to_rad);
+    const float64x2_t half = vdupq_n_f64(0.5);
+    const float64x2_t one = vdupq_n_f64(1.);
+    const int64x2_t one_i = vdupq_n_s64(1);
+    const int64x2_t two_i = vdupq_n_s64(2);
+
+    int j = 0;
+    for (; j + 2 <= n; j += 2)
+    {
+        float64x2_t x = vld1q_f64(&lst[j]);
+        float64x2_t k = vrndnq_f64(vmulq_f64(x, ninetieth));
+        float64x2_t r = vmulq_f64(vfmsq_f64(x, ninety, k), to_rad);
+        float64x2_t z = vmulq_f64(r, r);
+
+        float64x2_t ps = vdupq_n_f64(sin_coeffs[5]);
+        float64x2_t pc = vdupq_n_f64(cos_coeffs[5]);
+        for (int i = 4; i >= 0; i--)
+        {
+            ps = vfmaq_f64(vdupq_n_f64(sin_coeffs[i]), ps, z);
+            pc = vfmaq_f64(vdupq_n_f64(cos_coeffs[i]), pc, z);
+        }
+        float64x2_t sr = vfmaq_f64(r, vmulq_f64(r, z), ps);
+        float64x2_t cr = vfmaq_f64(vfmsq_f64(one, half, z),
+                vmulq_f64(z, z), pc);
+
+        int64x2_t q = vcvtq_s64_f64(k);
+        uint64x2_t swap = vtstq_s64(q, one_i);
+        uint64x2_t neg_s = vtstq_s64(q, two_i);
+        uint64x2_t neg_c = vtstq_s64(vaddq_s64(q, one_i), two_i);
+        float64x2_t sq = vbslq_f64(swap, cr, sr);
+        float64x2_t cq = vbslq_f64(swap, sr, cr);
+        vst1q_f64(&s[j], vbslq_f64(neg_s, vnegq_f64(sq), sq));
+        vst1q_f64(&c[j], vbslq_f64(neg_c, vnegq_f64(cq), cq));
+    }
+    sincos_block_scalar(&lst[j], n - j, &s[j], &c[j]);
+}
+
+static void combine_block_neon(double a, double b, double c,
+        const double *cos_lst, const double *sin_lst, int n, double *out)
+{
+    const float64x2_t va = vdupq_n_f64(a);
+    const float64x2_t vb = vdupq_n_f64(b);
+    const float64x2_t vc = vdupq_n_f64(c);
+    int j = 0;
+    for (; j + 2 <= n; j += 2)
+    {
+        float64x2_t v = vfmaq_f64(va, vb, vld1q_f64(&cos_lst[j]));
+        v = vfmaq_f64(v, vc, vld1q_f64(&sin_lst[j]));
+        vst1q_f64(&out[j], v);
+    }
+    combine_block_scalar(a, b, c, &cos_lst[j], &sin_lst[j], n - j, &out[j]);
+}
+#endif
+
+/* kernels of one implementation */
+struct altitude_kernel
+{
+    const char *name;
+    void (*sincos_block)(const double *, int, double *, double *);
+    void (*combine_block)(double, double, double, const double *,
+            const double *, int, double *);
+};
+
+static const struct altitude_kernel scalar_kernel = {"scalar",
+    sincos_block_scalar, combine_block_scalar};
+#ifdef VNIGHT_ALTITUDE_AVX2
+static const struct altitude_kernel avx2_kernel = {"avx2",
+    sincos_block_avx2, combine_block_avx2};
+#endif
+#ifdef VNIGHT_ALTITUDE_NEON
+static const struct altitude_kernel neon_kernel = {"neon",
+    sincos_block_neon, combine_block_neon};
+#endif
+
+/* picked on every call rather than cached, so that there is no shared
+   state to initialize. the cpu check is a load and a test. */
+static const struct altitude_kernel *altitude_kernel(void)
+{
+#if defined(VNIGHT_ALTITUDE_AVX2)
+    if (have_avx2())
+        return &avx2_kernel;
+#elif defined(VNIGHT_ALTITUDE_NEON)
+    return &neon_kernel;
+#endif
+    return &scalar_kernel;
+}
+
+const char *vnight_altitude_kernel(void)
+{
+    return altitude_kernel()->name;
+}
+
+/* terms a, b and c of each target, see the top of the file. returns NULL
+   if they cannot be allocated. */
+static double *target_terms(double latitude, const double *ra,
+        const double *dec, size_t n_targets)
+{
+    double sin_lat, cos_lat;
+    sincos_deg(latitude, &sin_lat, &cos_lat);
+
+    double *terms = malloc((3*n_targets + 1)*sizeof(double));
+    if (terms == NULL)
+        return NULL;
+    for (size_t i = 0; i < n_targets; i++)
+    {
+        double sin_dec, cos_dec, sin_ra, cos_ra;
+        sincos_deg(dec[i], &sin_dec, &cos_dec);
+        sincos_deg(ra[i], &sin_ra, &cos_ra);
+        terms[3*i] = sin_lat*sin_dec;
+        terms[3*i + 1] = cos_lat*cos_dec*cos_ra;
+        terms[3*i + 2] = cos_lat*cos_dec*sin_ra;
+    }
+    return terms;
+}
+
+int vnight_sin_altitudes(double latitude, const double *ra,
+        const double *dec, size_t n_targets, const double *lst,
+        size_t n_times, double *sin_alt)
+{
+    const struct altitude_kernel *kernel = altitude_kernel();
+    /* computed once for all times */
+    double *terms = target_terms(latitude, ra, dec, n_targets);
+    if (terms == NULL)
+        return VNIGHT_NO_MEMORY;
+
+    double sin_lst[ALTITUDE_BLOCK];
+    double cos_lst[ALTITUDE_BLOCK];
+    for (size_t j0 = 0; j0 < n_times; j0 += ALTITUDE_BLOCK)
+    {
+        int n = n_times - j0 < ALTITUDE_BLOCK ? (int)(n_times - j0) :
+            ALTITUDE_BLOCK;
+        kernel->sincos_block(&lst[j0], n, sin_lst, cos_lst);
+        for (size_t i = 0; i < n_targets; i++)
+            kernel->combine_block(terms[3*i], terms[3*i + 1],
+                    terms[3*i + 2], cos_lst, sin_lst, n,
+                    &sin_alt[i*n_times + j0]);
+    }
+
+    free(terms);
+    return VNIGHT_OK;
+}
+
+int vnight_altitudes(double latitude, const double *ra, const double *dec,
+        size_t n_targets, const double *lst, size_t n_times, double *alt)
+{
+    int status = vnight_sin_altitudes(latitude, ra, dec, n_targets, lst,
+            n_times, alt);
+    if (status != VNIGHT_OK)
+        return status;
+
+    for (size_t i = 0; i < n_targets*n_times; i++)
+    {
+        double s = alt[i];
+        /* rounding can take a target at the zenith just past 1 */
+        if (s > 1.)
+            s = 1.;
+        else if (s < -1.)
+            s = -1.;
+        alt[i] = asin(s)/deg_to_rad;
+    }
+
+    return VNIGHT_OK;
+}
+
+int vnight_time_above(double latitude, const double *ra, const double *dec,
+        size_t n_targets, const double *lst, const double *weights,
+        size_t n_times, double elevation, double *time)
+{
+    const struct altitude_kernel *kernel = altitude_kernel();
+    double *terms = target_terms(latitude, ra, dec, n_targets);
+    if (terms == NULL)
+        return VNIGHT_NO_MEMORY;
+
+    double sin_cut, cos_cut;
+    sincos_deg(elevation, &sin_cut, &cos_cut);
+    for (size_t i = 0; i < n_targets; i++)
+        time[i] = 0.;
+
+    /* a block of one target's values at a time, nothing is written out
+       but the sums */
+    double sin_lst[ALTITUDE_BLOCK];
+    double cos_lst[ALTITUDE_BLOCK];
+    double sin_alt[ALTITUDE_BLOCK];
+    for (size_t j0 = 0; j0 < n_times; j0 += ALTITUDE_BLOCK)
+    {
+        int n = n_times - j0 < ALTITUDE_BLOCK ? (int)(n_times - j0) :
+            ALTITUDE_BLOCK;
+        kernel->sincos_block(&lst[j0], n, sin_lst, cos_lst);
+        for (size_t i = 0; i < n_targets; i++)
+        {
+            kernel->combine_block(terms[3*i], terms[3*i + 1],
+                    terms[3*i + 2], cos_lst, sin_lst, n, sin_alt);
+            double sum = 0.;
+            for (int j = 0; j < n; j++)
+                sum += sin_alt[j] > sin_cut ? weights[j0 + j] : 0.;
+            time[i] += sum;
+        }
+    }
+
+    free(terms);
+    return VNIGHT_OK;
+}
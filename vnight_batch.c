@@ -0,0 +1,102 @@
+#include <math.h>
+#include <string.h>
+
+#include "vnight.h"
+
+/* compact storage of computed nights for batch mode. a night is kept as
+   the julian dates of its events and the moon illumination and altitude
+   at each in single precision; the calendar dates and labels that
+   struct ephem_data carries are made again when a night is taken out. */
+
+static const char *event_labels[VNIGHT_EVENTS] =
+{
+    "Sun Set",
+    "Sun Rise",
+    "Moon Set",
+    "Moon Rise"
+};
+
+const char *vnight_event_label(int event)
+{
+    if (event < 0 || event >= VNIGHT_EVENTS)
+        return "";
+    return event_labels[event];
+}
+
+/* the 4 decimals vnight prints the moon illumination and altitude to.
+   they are rounded to that before they are narrowed to a float, which is
+   good to a few 1e-6 degrees, so a night printed from a batch reads the
+   same as one printed as it was computed. */
+#define BATCH_SCALE 1e4
+
+static float batch_value(double value)
+{
+    return (float)(nearbyint(value*BATCH_SCALE)/BATCH_SCALE);
+}
+
+size_t ephem_batch_size(size_t nights)
+{
+    return nights*(VNIGHT_EVENTS*(sizeof(double) + 2*sizeof(float)) +
+            sizeof(int32_t));
+}
+
+void ephem_batch_init(struct ephem_batch *batch, void *memory, size_t nights)
+{
+    /* the arrays are laid out widest first, so each one is aligned */
+    size_t events = nights*VNIGHT_EVENTS;
+    batch->nights = nights;
+    batch->jd = memory;
+    batch->moon_illum = (float *)(batch->jd + events);
+    batch->moon_alt = batch->moon_illum + events;
+    batch->status = (int32_t *)(batch->moon_alt + events);
+}
+
+void ephem_batch_put(struct ephem_batch *batch, size_t i,
+        const struct ephem_night *night, int status)
+{
+    const struct ephem_data *events[VNIGHT_EVENTS] = {&(night->sun_set),
+        &(night->sun_rise), &(night->moon_set), &(night->moon_rise)};
+
+    size_t r = i*VNIGHT_EVENTS;
+    for (int e = 0; e < VNIGHT_EVENTS; e++)
+    {
+        batch->jd[r + e] = events[e]->jd;
+        batch->moon_illum[r + e] = batch_value(events[e]->moon_illum);
+        batch->moon_alt[r + e] = batch_value(events[e]->moon_alt);
+    }
+    batch->status[i] = status;
+}
+
+int ephem_batch_get(const struct ephem_batch *batch, size_t i,
+        struct ephem_night *night)
+{
+    struct ephem_data *events[VNIGHT_EVENTS] = {&(night->sun_set),
+        &(night->sun_rise), &(night->moon_set), &(night->moon_rise)};
+
+    /* events the solvers did not fill in are zero, date and all, as in
+       get_night_ephem */
+    memset(night, 0, sizeof(*night));
+    size_t r = i*VNIGHT_EVENTS;
+    for (int e = 0; e < VNIGHT_EVENTS; e++)
+    {
+        events[e]->jd = batch->jd[r + e];
+        events[e]->moon_illum = batch->moon_illum[r + e];
+        events[e]->moon_alt = batch->moon_alt[r + e];
+        strcpy(events[e]->label, event_labels[e]);
+    }
+    return batch->status[i];
+}
+
+void ephem_batch_record(const struct ephem_batch *batch, size_t i,
+        struct ephem_table_record *record)
+{
+    size_t r = i*VNIGHT_EVENTS;
+    for (int e = 0; e < VNIGHT_EVENTS; e++)
+    {
+        record->event[e].jd = batch->jd[r + e];
+        record->event[e].moon_illum = batch->moon_illum[r + e];
+        record->event[e].moon_alt = batch->moon_alt[r + e];
+    }
+    record->status = batch->status[i];
+    record->reserved = 0;
+}
@@ -0,0 +1,143 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "libnova/utility.h"
+
+#include "vnight.h"
+
+/* per-year night tables kept between runs, so that a driver asking for
+   the same nights again only maps them. each table covers a whole UT
+   year and is filled in as its nights are asked for. */
+
+int ephem_cache_key(char *key, size_t size, const struct vnight_site *site,
+        const char *solver)
+{
+    /* results follow libnova, so tables made with another one are not
+       reused. the version is part of a directory name. */
+    char nova[33];
+    snprintf(nova, sizeof(nova), "%s", ln_get_version());
+    for (char *p = nova; *p != '\0'; p++)
+        if (!isalnum((unsigned char)*p) && *p != '.' && *p != '+' &&
+                *p != '-')
+            *p = '-';
+
+    int n = snprintf(key, size, "v%d_nova%s_%s_%+.6f_%+.6f_%+.6f_%+.6f",
+            VNIGHT_CACHE_VERSION, nova, solver, site->latitude,
+            site->longitude, site->horizon_begin, site->horizon_end);
+    if (n < 0 || (size_t)n >= size)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
+
+int ephem_cache_path(char *path, size_t size, const char *dir,
+        const struct vnight_site *site, const char *solver, int year)
+{
+    char key[VNIGHT_CACHE_KEY_SIZE];
+    if (ephem_cache_key(key, sizeof(key), site, solver) != VNIGHT_OK)
+        return VNIGHT_FILE_ERROR;
+
+    int n = snprintf(path, size, "%s/%s/%04d.vnt", dir, key, year);
+    if (n < 0 || (size_t)n >= size)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
+
+/* first night and number of nights of a UT year */
+static int year_span(int year, double *start_mjd, int32_t *nights)
+{
+    double stop_mjd;
+    if (year < 0 ||
+            vnight_date_to_mjd(year, 1, 1, start_mjd) != VNIGHT_OK ||
+            vnight_date_to_mjd(year + 1, 1, 1, &stop_mjd) != VNIGHT_OK)
+        return VNIGHT_BAD_DATE;
+
+    *nights = (int32_t)(stop_mjd - *start_mjd);
+    return VNIGHT_OK;
+}
+
+int ephem_cache_load(const char *dir, const struct vnight_site *site,
+        const char *solver, int year, double *start_mjd, int32_t *nights,
+        struct ephem_table_record **records)
+{
+    int status = year_span(year, start_mjd, nights);
+    if (status != VNIGHT_OK)
+        return status;
+
+    char path[4096];
+    if (ephem_cache_path(path, sizeof(path), dir, site, solver, year)
+            != VNIGHT_OK)
+        return VNIGHT_FILE_ERROR;
+
+    *records = malloc(*nights*sizeof(struct ephem_table_record));
+    if (*records == NULL)
+        return VNIGHT_NO_MEMORY;
+
+    /* a table that does not have exactly this year is treated like a
+       missing one, it is replaced when the year is stored */
+    struct ephem_table table;
+    if (ephem_table_map(path, site, &table) == VNIGHT_OK &&
+            table.header->start_mjd == *start_mjd &&
+            table.header->nights == *nights)
+    {
+        memcpy(*records, table.records,
+                *nights*sizeof(struct ephem_table_record));
+        ephem_table_unmap(&table);
+        return VNIGHT_OK;
+    }
+    ephem_table_unmap(&table);
+
+    memset(*records, 0, *nights*sizeof(struct ephem_table_record));
+    for (int32_t i = 0; i < *nights; i++)
+        (*records)[i].status = VNIGHT_NOT_CACHED;
+
+    return VNIGHT_OK;
+}
+
+/* mkdir that is happy with a directory already there */
+static int make_dir(const char *path)
+{
+    if (mkdir(path, 0777) != 0 && errno != EEXIST)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
+
+int ephem_cache_store(const char *dir, const struct vnight_site *site,
+        const char *solver, int year, double start_mjd, int32_t nights,
+        const struct ephem_table_record *records)
+{
+    char key[VNIGHT_CACHE_KEY_SIZE];
+    char path[4096];
+    char subdir[4096];
+    char tmp[4096];
+    if (ephem_cache_key(key, sizeof(key), site, solver) != VNIGHT_OK ||
+            ephem_cache_path(path, sizeof(path), dir, site, solver, year)
+                != VNIGHT_OK)
+        return VNIGHT_FILE_ERROR;
+    int n = snprintf(subdir, sizeof(subdir), "%s/%s", dir, key);
+    int m = snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+    if (n < 0 || (size_t)n >= sizeof(subdir) ||
+            m < 0 || (size_t)m >= sizeof(tmp))
+        return VNIGHT_FILE_ERROR;
+
+    if (make_dir(dir) != VNIGHT_OK || make_dir(subdir) != VNIGHT_OK)
+        return VNIGHT_FILE_ERROR;
+
+    /* the table is written next to the old one and renamed over it, so a
+       process mapping the old table keeps a consistent copy and two
+       processes filling the same year do not mix their records */
+    int status = ephem_table_write(tmp, site, start_mjd, nights, records);
+    if (status == VNIGHT_OK && rename(tmp, path) != 0)
+        status = VNIGHT_FILE_ERROR;
+    if (status != VNIGHT_OK)
+        unlink(tmp);
+
+    return status;
+}
@@ -0,0 +1,269 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnova/lunar.h"
+#include "libnova/utility.h"
+
+#include "vnight.h"
+
+/* piecewise chebyshev fits of the moon's geocentric ra, dec, distance, and
+   illuminated fraction. a fit covering the date range of a run replaces the
+   full lunar theory for every moon evaluation libvnight makes. */
+
+/* quantities fitted in each segment, in the order they are stored */
+enum
+{
+    CHEB_RA = 0,
+    CHEB_DEC,
+    CHEB_DIST,
+    CHEB_ILLUM,
+    CHEB_QUANTITIES
+};
+
+static const char cheb_magic[8] = {'V', 'N', 'C', 'H', 'E', 'B', '1', '\0'};
+
+/* fit used by vnight_moon_equ_coords and vnight_moon_disk, NULL for the
+   direct libnova routines */
+static const struct lunar_cheb *active_cheb;
+
+/* coefficients of quantity q in segment i */
+static double *cheb_coeffs(const struct lunar_cheb *cheb, int i, int q)
+{
+    return cheb->coeffs + ((size_t)i*CHEB_QUANTITIES + q)*cheb->order;
+}
+
+/* clenshaw summation of a chebyshev series at x in [-1, 1] */
+static double cheb_sum(const double *c, int order, double x)
+{
+    double b0 = 0.;
+    double b1 = 0.;
+    for (int j = order - 1; j >= 1; j--)
+    {
+        double t = 2.*x*b0 - b1 + c[j];
+        b1 = b0;
+        b0 = t;
+    }
+    return x*b0 - b1 + c[0]/2.;
+}
+
+int lunar_cheb_build(struct lunar_cheb *cheb, double start_jd, double stop_jd)
+{
+    cheb->start = start_jd;
+    cheb->span = VNIGHT_CHEB_SPAN;
+    cheb->order = VNIGHT_CHEB_ORDER;
+    cheb->nsegments = (int)ceil((stop_jd - start_jd)/cheb->span);
+    if (cheb->nsegments < 1)
+        cheb->nsegments = 1;
+    cheb->coeffs = malloc((size_t)cheb->nsegments*CHEB_QUANTITIES*
+            cheb->order*sizeof(double));
+    if (cheb->coeffs == NULL)
+        return VNIGHT_NO_MEMORY;
+
+    int n = cheb->order;
+    double samples[CHEB_QUANTITIES][VNIGHT_CHEB_ORDER];
+    for (int i = 0; i < cheb->nsegments; i++)
+    {
+        double mid = cheb->start + (i + 0.5)*cheb->span;
+        double half = cheb->span/2.;
+
+        /* sample at the chebyshev nodes. nodes run from the end of the
+           segment to the start, so ra is unwrapped in that order. */
+        for (int k = 0; k < n; k++)
+        {
+            double jd = mid + half*cos(M_PI*(k + 0.5)/n);
+            struct ln_equ_posn posn;
+            ln_get_lunar_equ_coords(jd, &posn);
+            VNIGHT_COUNT(VNIGHT_STAT_LUNAR_POSITIONS);
+            samples[CHEB_RA][k] = posn.ra;
+            if (k > 0)
+            {
+                while (samples[CHEB_RA][k] - samples[CHEB_RA][k - 1] > 180.)
+                    samples[CHEB_RA][k] -= 360.;
+                while (samples[CHEB_RA][k] - samples[CHEB_RA][k - 1] < -180.)
+                    samples[CHEB_RA][k] += 360.;
+            }
+            samples[CHEB_DEC][k] = posn.dec;
+            samples[CHEB_DIST][k] = ln_get_lunar_earth_dist(jd);
+            samples[CHEB_ILLUM][k] = ln_get_lunar_disk(jd);
+        }
+
+        for (int q = 0; q < CHEB_QUANTITIES; q++)
+        {
+            double *c = cheb_coeffs(cheb, i, q);
+            for (int j = 0; j < n; j++)
+            {
+                double sum = 0.;
+                for (int k = 0; k < n; k++)
+                    sum += samples[q][k]*cos(M_PI*j*(k + 0.5)/n);
+                c[j] = 2.*sum/n;
+            }
+        }
+    }
+
+    return VNIGHT_OK;
+}
+
+int lunar_cheb_eval(const struct lunar_cheb *cheb, double jd,
+        struct ln_equ_posn *posn, double *dist, double *illum)
+{
+    double t = (jd - cheb->start)/cheb->span;
+    int i = (int)floor(t);
+    /* the end of the last segment is still covered */
+    if (i == cheb->nsegments && t == cheb->nsegments)
+        i--;
+    if (i < 0 || i >= cheb->nsegments)
+        return VNIGHT_OUT_OF_RANGE;
+
+    double x = 2.*(t - i) - 1.;
+    if (posn != NULL)
+    {
+        posn->ra = ln_range_degrees(cheb_sum(cheb_coeffs(cheb, i, CHEB_RA),
+                    cheb->order, x));
+        posn->dec = cheb_sum(cheb_coeffs(cheb, i, CHEB_DEC), cheb->order, x);
+    }
+    if (dist != NULL)
+        *dist = cheb_sum(cheb_coeffs(cheb, i, CHEB_DIST), cheb->order, x);
+    if (illum != NULL)
+        *illum = cheb_sum(cheb_coeffs(cheb, i, CHEB_ILLUM), cheb->order, x);
+
+    return VNIGHT_OK;
+}
+
+int lunar_cheb_covers(const struct lunar_cheb *cheb, double start_jd,
+        double stop_jd)
+{
+    return start_jd >= cheb->start &&
+        stop_jd <= cheb->start + cheb->nsegments*cheb->span;
+}
+
+void lunar_cheb_free(struct lunar_cheb *cheb)
+{
+    if (active_cheb == cheb)
+        active_cheb = NULL;
+    free(cheb->coeffs);
+    cheb->coeffs = NULL;
+    cheb->nsegments = 0;
+}
+
+/* file layout: magic, start, span, order, nsegments, then the coefficients
+   as native doubles */
+int lunar_cheb_write(const struct lunar_cheb *cheb, const char *path)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return VNIGHT_FILE_ERROR;
+
+    size_t ncoeffs = (size_t)cheb->nsegments*CHEB_QUANTITIES*cheb->order;
+    int ok = fwrite(cheb_magic, sizeof(cheb_magic), 1, fp) == 1 &&
+        fwrite(&(cheb->start), sizeof(double), 1, fp) == 1 &&
+        fwrite(&(cheb->span), sizeof(double), 1, fp) == 1 &&
+        fwrite(&(cheb->order), sizeof(int), 1, fp) == 1 &&
+        fwrite(&(cheb->nsegments), sizeof(int), 1, fp) == 1 &&
+        fwrite(cheb->coeffs, sizeof(double), ncoeffs, fp) == ncoeffs;
+
+    if (fclose(fp) != 0 || !ok)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
+
+int lunar_cheb_read(struct lunar_cheb *cheb, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return VNIGHT_FILE_ERROR;
+
+    char magic[sizeof(cheb_magic)];
+    cheb->coeffs = NULL;
+    int ok = fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, cheb_magic, sizeof(magic)) == 0 &&
+        fread(&(cheb->start), sizeof(double), 1, fp) == 1 &&
+        fread(&(cheb->span), sizeof(double), 1, fp) == 1 &&
+        fread(&(cheb->order), sizeof(int), 1, fp) == 1 &&
+        fread(&(cheb->nsegments), sizeof(int), 1, fp) == 1 &&
+        cheb->order > 0 && cheb->order <= VNIGHT_CHEB_ORDER &&
+        cheb->nsegments > 0 && cheb->span > 0.;
+
+    if (ok)
+    {
+        size_t ncoeffs = (size_t)cheb->nsegments*CHEB_QUANTITIES*cheb->order;
+        cheb->coeffs = malloc(ncoeffs*sizeof(double));
+        ok = cheb->coeffs != NULL &&
+            fread(cheb->coeffs, sizeof(double), ncoeffs, fp) == ncoeffs;
+    }
+
+    fclose(fp);
+    if (!ok)
+    {
+        free(cheb->coeffs);
+        cheb->coeffs = NULL;
+        cheb->nsegments = 0;
+        return VNIGHT_FILE_ERROR;
+    }
+
+    return VNIGHT_OK;
+}
+
+void lunar_cheb_validate(const struct lunar_cheb *cheb, double step,
+        struct lunar_cheb_error *err)
+{
+    memset(err, 0, sizeof(*err));
+
+    double stop = cheb->start + cheb->nsegments*cheb->span;
+    for (double jd = cheb->start; jd < stop; jd += step)
+    {
+        struct ln_equ_posn fit, direct;
+        double dist, illum;
+        lunar_cheb_eval(cheb, jd, &fit, &dist, &illum);
+        ln_get_lunar_equ_coords(jd, &direct);
+
+        double dra = fabs(fit.ra - direct.ra);
+        if (dra > 180.)
+            dra = 360. - dra;
+        /* ra error as an angle on the sky */
+        dra *= cos(ln_deg_to_rad(direct.dec));
+        double ddec = fabs(fit.dec - direct.dec);
+        double ddist = fabs(dist - ln_get_lunar_earth_dist(jd));
+        double dillum = fabs(illum - ln_get_lunar_disk(jd));
+
+        if (dra*3600. > err->ra)
+            err->ra = dra*3600.;
+        if (ddec*3600. > err->dec)
+            err->dec = ddec*3600.;
+        if (ddist > err->dist)
+            err->dist = ddist;
+        if (dillum > err->illum)
+            err->illum = dillum;
+        err->samples++;
+    }
+}
+
+void vnight_set_lunar_cheb(const struct lunar_cheb *cheb)
+{
+    active_cheb = cheb;
+}
+
+const struct lunar_cheb *vnight_get_lunar_cheb(void)
+{
+    return active_cheb;
+}
+
+void vnight_moon_equ_coords(double jd, struct ln_equ_posn *posn)
+{
+    VNIGHT_COUNT(VNIGHT_STAT_LUNAR_POSITIONS);
+    if (active_cheb == NULL ||
+            lunar_cheb_eval(active_cheb, jd, posn, NULL, NULL) != VNIGHT_OK)
+        ln_get_lunar_equ_coords(jd, posn);
+}
+
+double vnight_moon_disk(double jd)
+{
+    double illum;
+    if (active_cheb == NULL ||
+            lunar_cheb_eval(active_cheb, jd, NULL, NULL, &illum) != VNIGHT_OK)
+        return ln_get_lunar_disk(jd);
+
+    return illum;
+}
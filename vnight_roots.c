@@ -0,0 +1,564 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libnova/julian_day.h"
+#include "libnova/rise_set.h"
+#include "libnova/sidereal_time.h"
+#include "libnova/solar.h"
+#include "libnova/utility.h"
+
+#include "vnight.h"
+
+/* rise and set times found as the crossings of the altitude itself,
+   rather than with the rst method of libnova, which solves for rise and
+   set from three positions a day apart and has no answer on days where
+   an event is missing. the positions are evaluated at a few nodes a day
+   and shared by every site and by consecutive dates, so a night costs
+   two new positions of each body and the rest is interpolation. */
+
+/* event times are refined to this, in days */
+#define ROOTS_TOLERANCE 1e-9
+#define ROOTS_MAX_ITERATIONS 60
+/* days searched from 0h UT of the date for each event */
+#define ROOTS_SPAN 2
+#define ROOTS_SAMPLES (ROOTS_SPAN*VNIGHT_ROOTS_SAMPLES_PER_DAY)
+
+/* sidereal rate in degrees per day, as in ln_get_mean_sidereal_time */
+static const double sidereal_rate = 360.98564736629;
+
+void init_night_track(struct night_track *track)
+{
+    memset(track, 0, sizeof(*track));
+}
+
+/* put node i of each body at jd */
+static void set_nodes(struct night_track *track, int i, double jd)
+{
+    struct ln_equ_posn posn;
+    ln_get_solar_equ_coords(jd, &posn);
+    VNIGHT_COUNT(VNIGHT_STAT_SOLAR_POSITIONS);
+    track->sun.ra[i] = posn.ra;
+    track->sun.dec[i] = posn.dec;
+    vnight_moon_equ_coords(jd, &posn);
+    track->moon.ra[i] = posn.ra;
+    track->moon.dec[i] = posn.dec;
+    track->moon_illum[i] = vnight_moon_disk(jd);
+}
+
+/* keep ra continuous from node begin on, and near 0h at the first node */
+static void unwrap_nodes(struct track_nodes *nodes, int begin)
+{
+    for (int i = begin > 0 ? begin : 1; i < VNIGHT_TRACK_NODES; i++)
+    {
+        while (nodes->ra[i] - nodes->ra[i - 1] > 180.)
+            nodes->ra[i] -= 360.;
+        while (nodes->ra[i] - nodes->ra[i - 1] < -180.)
+            nodes->ra[i] += 360.;
+    }
+    double turns = floor(nodes->ra[0]/360.);
+    if (turns != 0.)
+    {
+        for (int i = 0; i < VNIGHT_TRACK_NODES; i++)
+            nodes->ra[i] -= turns*360.;
+    }
+}
+
+void update_night_track(struct night_track *track, double mjd)
+{
+    /* same julian date as ctx->jd + 0.5 */
+    double day0 = mjd + 2400000 + 0.5;
+    const struct lunar_cheb *cheb = vnight_get_lunar_cheb();
+    if (track->valid && track->day0 == day0 && track->cheb == cheb)
+        return;
+
+    double first = day0 - 1.;
+    int keep = 0;
+    if (track->valid && track->cheb == cheb && day0 > track->day0)
+    {
+        double shift = (day0 - track->day0)/VNIGHT_TRACK_STEP;
+        if (shift == floor(shift) && shift < VNIGHT_TRACK_NODES)
+            keep = VNIGHT_TRACK_NODES - (int)shift;
+    }
+
+    if (keep > 0)
+    {
+        int shift = VNIGHT_TRACK_NODES - keep;
+        memmove(track->sun.ra, track->sun.ra + shift, keep*sizeof(double));
+        memmove(track->sun.dec, track->sun.dec + shift, keep*sizeof(double));
+        memmove(track->moon.ra, track->moon.ra + shift,
+                keep*sizeof(double));
+        memmove(track->moon.dec, track->moon.dec + shift,
+                keep*sizeof(double));
+        memmove(track->moon_illum, track->moon_illum + shift,
+                keep*sizeof(double));
+    }
+    for (int i = keep; i < VNIGHT_TRACK_NODES; i++)
+        set_nodes(track, i, first + i*VNIGHT_TRACK_STEP);
+    unwrap_nodes(&(track->sun), keep);
+    unwrap_nodes(&(track->moon), keep);
+
+    track->sidereal = ln_get_apparent_sidereal_time(day0)*15.;
+    track->day0 = day0;
+    track->first = first;
+    track->cheb = cheb;
+    track->valid = 1;
+}
+
+/* cubic through the four nodes around jd, and *rate its derivative per
+   day */
+static double track_value(const struct night_track *track, const double *y,
+        double jd, double *rate)
+{
+    double x = (jd - track->first)/VNIGHT_TRACK_STEP;
+    int k = (int)floor(x) - 1;
+    if (k < 0)
+        k = 0;
+    else if (k > VNIGHT_TRACK_NODES - 4)
+        k = VNIGHT_TRACK_NODES - 4;
+    double u = x - k;
+    y += k;
+
+    /* newton forward differences */
+    double d1 = y[1] - y[0];
+    double d2 = y[2] - 2.*y[1] + y[0];
+    double d3 = y[3] - 3.*y[2] + 3.*y[1] - y[0];
+    if (rate != NULL)
+        *rate = (d1 + (2.*u - 1.)/2.*d2 + (3.*u*u - 6.*u + 2.)/6.*d3)/
+            VNIGHT_TRACK_STEP;
+    return y[0] + u*(d1 + (u - 1.)/2.*(d2 + (u - 2.)/3.*d3));
+}
+
+/* sine of the altitude of a body at jd and its derivative per day */
+static double sin_altitude(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        double jd, double *rate)
+{
+    double ra_rate, dec_rate;
+    double ra = track_value(track, body->ra, jd, &ra_rate);
+    double dec = ln_deg_to_rad(track_value(track, body->dec, jd,
+                &dec_rate));
+    double ha = ln_deg_to_rad(track->sidereal + sidereal_rate*(jd -
+                track->day0) + observer->lng - ra);
+    double ha_rate = ln_deg_to_rad(sidereal_rate - ra_rate);
+    dec_rate = ln_deg_to_rad(dec_rate);
+
+    double lat = ln_deg_to_rad(observer->lat);
+    double sin_lat = sin(lat);
+    double cos_lat = cos(lat);
+    double sin_dec = sin(dec);
+    double cos_dec = cos(dec);
+    double cos_ha = cos(ha);
+    *rate = sin_lat*cos_dec*dec_rate
+        - cos_lat*(sin_dec*cos_ha*dec_rate + cos_dec*sin(ha)*ha_rate);
+    return sin_lat*sin_dec + cos_lat*cos_dec*cos_ha;
+}
+
+/* altitude of a body sampled through the span searched, n samples so
+   far */
+struct body_samples
+{
+    int n;
+    double f[ROOTS_SAMPLES + 1];
+    double df[ROOTS_SAMPLES + 1];
+};
+
+/* sample up to and including sample last */
+static void sample_body(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        struct body_samples *samples, int last)
+{
+    for (int i = samples->n; i <= last; i++)
+        samples->f[i] = sin_altitude(track, body, observer,
+                track->day0 + (double)i/VNIGHT_ROOTS_SAMPLES_PER_DAY,
+                &(samples->df[i]));
+    if (samples->n <= last)
+        samples->n = last + 1;
+}
+
+/* the crossing of sin_h0 between a and b, where the altitude is on
+   either side of it */
+static double refine(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        double sin_h0, double a, double fa, double b, double fb)
+{
+    double t = a - fa*(b - a)/(fb - fa);
+    for (int i = 0; i < ROOTS_MAX_ITERATIONS; i++)
+    {
+        VNIGHT_COUNT(VNIGHT_STAT_ROOTS_ITERATIONS);
+        double df;
+        double f = sin_altitude(track, body, observer, t, &df) - sin_h0;
+        if (f == 0.)
+            return t;
+        if ((f < 0.) == (fa < 0.))
+        {
+            a = t;
+            fa = f;
+        }
+        else
+            b = t;
+
+        double next = df != 0. ? t - f/df : a;
+        if (!(next > a && next < b))
+            next = 0.5*(a + b);
+        if (fabs(next - t) < ROOTS_TOLERANCE)
+            return next;
+        t = next;
+    }
+    return t;
+}
+
+/* time of the highest or lowest altitude between a and b, where the
+   altitude rate changes sign */
+static double extremum(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        double a, double dfa, double b)
+{
+    while (b - a > ROOTS_TOLERANCE)
+    {
+        double m = 0.5*(a + b);
+        double dfm;
+        sin_altitude(track, body, observer, m, &dfm);
+        if ((dfm < 0.) == (dfa < 0.))
+        {
+            a = m;
+            dfa = dfm;
+        }
+        else
+            b = m;
+    }
+    return 0.5*(a + b);
+}
+
+/* crossings of one horizon in a day of samples, in time order. rising
+   is 1 for a crossing upwards. */
+struct day_crossings
+{
+    int n;
+    double jd[VNIGHT_MAX_CROSSINGS];
+    int rising[VNIGHT_MAX_CROSSINGS];
+};
+
+static void add_crossing(struct day_crossings *found, double jd, int rising)
+{
+    if (found->n == VNIGHT_MAX_CROSSINGS)
+        return;
+    found->jd[found->n] = jd;
+    found->rising[found->n++] = rising;
+}
+
+/* crossings of horizon in day (0 or 1) of the span searched. the samples
+   are close enough that a body will cross at most twice between two of
+   them, and then only where it turns around just past the horizon, which
+   is looked for where the altitude rate changes sign. */
+static void find_crossings(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        struct body_samples *samples, double horizon, int day,
+        struct day_crossings *found)
+{
+    const int per_day = VNIGHT_ROOTS_SAMPLES_PER_DAY;
+    const double h = 1./per_day;
+    double sin_h0 = sin(ln_deg_to_rad(horizon));
+    sample_body(track, body, observer, samples, (day + 1)*per_day);
+
+    found->n = 0;
+    for (int i = day*per_day; i < (day + 1)*per_day; i++)
+    {
+        double a = track->day0 + i*h;
+        double b = a + h;
+        double fa = samples->f[i] - sin_h0;
+        double fb = samples->f[i + 1] - sin_h0;
+
+        if ((fa < 0.) != (fb < 0.))
+        {
+            add_crossing(found, refine(track, body, observer, sin_h0, a, fa,
+                        b, fb), fb >= 0.);
+            continue;
+        }
+
+        /* same side at both samples, but it may have dipped to the other
+           side in between */
+        if ((samples->df[i] < 0.) == (samples->df[i + 1] < 0.) ||
+                (fa >= 0.) != (samples->df[i] < 0.))
+            continue;
+        double m = extremum(track, body, observer, a, samples->df[i], b);
+        double dfm;
+        double fm = sin_altitude(track, body, observer, m, &dfm) - sin_h0;
+        if ((fm < 0.) == (fa < 0.))
+            continue;
+        add_crossing(found, refine(track, body, observer, sin_h0, a, fa, m,
+                    fm), fm >= 0.);
+        add_crossing(found, refine(track, body, observer, sin_h0, m, fm, b,
+                    fb), fb >= 0.);
+    }
+}
+
+/* first crossing of a direction, 0 if there is none */
+static int first_crossing(const struct day_crossings *found, int rising,
+        double *jd)
+{
+    for (int i = 0; i < found->n; i++)
+    {
+        if (found->rising[i] == rising)
+        {
+            *jd = found->jd[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* add the crossings of a direction to crossings as event */
+static void report_crossings(const struct day_crossings *found, int rising,
+        int event, struct night_crossings *crossings)
+{
+    if (crossings == NULL)
+        return;
+    for (int i = 0; i < found->n; i++)
+    {
+        if (found->rising[i] != rising ||
+                crossings->n == VNIGHT_MAX_CROSSINGS)
+            continue;
+        crossings->crossing[crossings->n].jd = found->jd[i];
+        crossings->crossing[crossings->n].event = event;
+        crossings->n++;
+    }
+}
+
+/* events of one horizon of a body, the first crossing of each direction
+   wanted from 0h UT on. the day after is only searched when the date
+   has none. returns the number of events found. */
+static int solve_horizon(const struct night_track *track,
+        const struct track_nodes *body, const struct ln_lnlat_posn *observer,
+        struct body_samples *samples, double horizon, int set_event,
+        int rise_event, double *event_jd, struct night_crossings *crossings)
+{
+    struct day_crossings found;
+    find_crossings(track, body, observer, samples, horizon, 0, &found);
+
+    int events[2] = {set_event, rise_event};
+    int solved[2] = {events[0] < 0, events[1] < 0};
+    for (int rising = 0; rising < 2; rising++)
+    {
+        if (solved[rising])
+            continue;
+        report_crossings(&found, rising, events[rising], crossings);
+        solved[rising] = first_crossing(&found, rising,
+                &event_jd[events[rising]]);
+    }
+
+    if (!solved[0] || !solved[1])
+    {
+        find_crossings(track, body, observer, samples, horizon, 1, &found);
+        for (int rising = 0; rising < 2; rising++)
+        {
+            if (solved[rising])
+                continue;
+            solved[rising] = first_crossing(&found, rising,
+                    &event_jd[events[rising]]);
+            if (solved[rising])
+                VNIGHT_COUNT(VNIGHT_STAT_NEXT_DAY_EVENTS);
+        }
+    }
+
+    return (events[0] >= 0 && solved[0]) + (events[1] >= 0 && solved[1]);
+}
+
+static int crossing_compar(const void *a, const void *b)
+{
+    double ja = ((const struct vnight_crossing *)a)->jd;
+    double jb = ((const struct vnight_crossing *)b)->jd;
+    return ja < jb ? -1 : ja > jb;
+}
+
+/* moon altitude and illumination at jd from the track, like
+   get_moon_alt_and_illum */
+static void track_moon(const struct night_track *track,
+        const struct ln_lnlat_posn *observer, double jd, double *alt,
+        double *illum)
+{
+    double rate;
+    double sin_alt = sin_altitude(track, &(track->moon), observer, jd,
+            &rate);
+    *alt = ln_rad_to_deg(asin(sin_alt));
+    *illum = track_value(track, track->moon_illum, jd, NULL);
+    if (*alt < 0.)
+        *illum *= -1.;
+}
+
+/* get_night_ephem_roots, leaving the moon and sun altitude samples it
+   took in moon and sun */
+static int solve_night(struct night_track *track, struct night_context *ctx,
+        struct ephem_night *night, struct night_crossings *crossings,
+        struct body_samples *moon, struct body_samples *sun)
+{
+    memset(night, 0, sizeof(*night));
+    strcpy(night->sun_set.label, "Sun Set");
+    strcpy(night->sun_rise.label, "Sun Rise");
+    strcpy(night->moon_set.label, "Moon Set");
+    strcpy(night->moon_rise.label, "Moon Rise");
+    if (crossings != NULL)
+        crossings->n = 0;
+
+    VNIGHT_TIMER_START(VNIGHT_TIME_ROOTS);
+    update_night_track(track, ctx->mjd);
+
+    int status = VNIGHT_OK;
+    double event_jd[4];
+
+    moon->n = 0;
+    if (solve_horizon(track, &(track->moon), &(ctx->observer), moon,
+                LN_LUNAR_STANDART_HORIZON, VNIGHT_MOON_SET,
+                VNIGHT_MOON_RISE, event_jd, crossings) != 2)
+        status |= VNIGHT_MOON_CIRCUMPOLAR;
+
+    /* the two twilight angles cross on the same samples */
+    sun->n = 0;
+    int sun_events = solve_horizon(track, &(track->sun), &(ctx->observer),
+            sun, ctx->site->horizon_begin, VNIGHT_SUN_SET, -1,
+            event_jd, crossings);
+    sun_events += solve_horizon(track, &(track->sun), &(ctx->observer),
+            sun, ctx->site->horizon_end, -1, VNIGHT_SUN_RISE,
+            event_jd, crossings);
+    if (sun_events != 2)
+        status |= VNIGHT_SUN_CIRCUMPOLAR;
+
+    if (crossings != NULL)
+        qsort(crossings->crossing, crossings->n,
+                sizeof(crossings->crossing[0]), crossing_compar);
+
+    /* events are only filled in when both of a body's are found, as with
+       the rst solvers */
+    if (!(status & VNIGHT_SUN_CIRCUMPOLAR))
+    {
+        struct ephem_data *sun[2] = {&(night->sun_set), &(night->sun_rise)};
+        for (int e = VNIGHT_SUN_SET; e <= VNIGHT_SUN_RISE; e++)
+        {
+            sun[e]->jd = event_jd[e];
+            sun[e]->date.months = 0;
+            track_moon(track, &(ctx->observer), event_jd[e],
+                    &(sun[e]->moon_alt), &(sun[e]->moon_illum));
+        }
+    }
+    if (!(status & VNIGHT_MOON_CIRCUMPOLAR))
+    {
+        struct ephem_data *moon[2] = {&(night->moon_set),
+            &(night->moon_rise)};
+        for (int e = 0; e < 2; e++)
+        {
+            double t = event_jd[VNIGHT_MOON_SET + e];
+            moon[e]->jd = t;
+            moon[e]->date.months = 0;
+            moon[e]->moon_illum = track_value(track, track->moon_illum, t,
+                    NULL);
+        }
+    }
+
+    VNIGHT_COUNT(VNIGHT_STAT_NIGHTS);
+    VNIGHT_COUNT_STATUS(status);
+    VNIGHT_TIMER_STOP(VNIGHT_TIME_ROOTS);
+    return status;
+}
+
+int get_night_ephem_roots(struct night_track *track,
+        struct night_context *ctx, struct ephem_night *night,
+        struct night_crossings *crossings)
+{
+    struct body_samples moon, sun;
+    return solve_night(track, ctx, night, crossings, &moon, &sun);
+}
+
+/* event of the window at jd, with the moon from the track */
+static void set_window_event(const struct night_track *track,
+        const struct ln_lnlat_posn *observer, double jd, const char *label,
+        struct ephem_data *data)
+{
+    data->jd = jd;
+    data->date.months = 0;
+    track_moon(track, observer, jd, &(data->moon_alt), &(data->moon_illum));
+    strcpy(data->label, label);
+}
+
+int get_night_window_roots(struct night_track *track,
+        struct night_context *ctx, struct ephem_night *night,
+        struct night_window *window)
+{
+    struct body_samples moon, sun;
+    int status = solve_night(track, ctx, night, NULL, &moon, &sun);
+
+    memset(window, 0, sizeof(*window));
+    strcpy(window->sun_set.label, "Sun Set");
+    strcpy(window->sun_rise.label, "Sun Rise");
+    if (status & VNIGHT_SUN_CIRCUMPOLAR)
+        return status;
+
+    /* the rise of the night is the first from 0h UT, which comes before
+       the set at sites east of VERITAS. the rise ending the window is
+       then the next one, a day later. */
+    double start = night->sun_set.jd;
+    double end = night->sun_rise.jd;
+    if (end < start)
+    {
+        struct day_crossings found;
+        int solved = 0;
+        for (int day = 0; day < ROOTS_SPAN && !solved; day++)
+        {
+            find_crossings(track, &(track->sun), &(ctx->observer), &sun,
+                    ctx->site->horizon_end, day, &found);
+            for (int i = 0; i < found.n && !solved; i++)
+            {
+                if (found.rising[i] && found.jd[i] > start)
+                {
+                    end = found.jd[i];
+                    solved = 1;
+                }
+            }
+        }
+        if (!solved)
+            return status | VNIGHT_OUT_OF_RANGE;
+    }
+
+    window->sun_set = night->sun_set;
+    set_window_event(track, &(ctx->observer), end, "Sun Rise",
+            &(window->sun_rise));
+
+    /* moon crossings of the days the window spans. the first day was
+       already sampled for the night, only the next one is new. */
+    double h0 = LN_LUNAR_STANDART_HORIZON;
+    int first_rising = -1;
+    int last_day = (int)floor(end - track->day0);
+    if (last_day >= ROOTS_SPAN)
+        last_day = ROOTS_SPAN - 1;
+    for (int day = (int)floor(start - track->day0); day <= last_day; day++)
+    {
+        if (day < 0)
+            continue;
+        struct day_crossings found;
+        find_crossings(track, &(track->moon), &(ctx->observer), &moon, h0,
+                day, &found);
+        for (int i = 0; i < found.n; i++)
+        {
+            if (found.jd[i] <= start || found.jd[i] >= end ||
+                    window->n_moon == VNIGHT_MAX_WINDOW_EVENTS)
+                continue;
+            if (window->n_moon == 0)
+                first_rising = found.rising[i];
+            struct ephem_data *data = &(window->moon[window->n_moon++]);
+            set_window_event(track, &(ctx->observer), found.jd[i],
+                    found.rising[i] ? "Moon Rise" : "Moon Set", data);
+            /* moon events keep the illuminated fraction as it is, like
+               those of the night */
+            data->moon_illum = fabs(data->moon_illum);
+            data->moon_alt = 0.;
+        }
+    }
+
+    /* whether the moon is up at the set follows from the first crossing
+       where there is one, so that it agrees with the events exactly */
+    if (first_rising >= 0)
+        window->moon_up = !first_rising;
+    else
+        window->moon_up = window->sun_set.moon_alt >= h0;
+
+    return status;
+}
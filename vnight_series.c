@@ -0,0 +1,149 @@
+#include <math.h>
+#include <string.h>
+
+#include "libnova/sidereal_time.h"
+#include "libnova/solar.h"
+#include "libnova/utility.h"
+
+#include "vnight.h"
+
+/* moon altitude, illumination and distance from the sun on a regular grid
+   through a night. the moon and sun are only evaluated at nodes every
+   VNIGHT_SERIES_NODE_STEP days, with one extra node on either side of the
+   night, and the samples between them are cubic interpolations. the
+   altitude of each sample is then exact for the interpolated position. */
+
+#define SERIES_MAX_NODES 16
+
+/* sidereal rate in degrees per day, as in ln_get_mean_sidereal_time */
+static const double sidereal_rate = 360.98564736629;
+
+/* cubic through y[0..3] at nodes 0, 1, 2, 3, evaluated at u */
+static double lagrange4(const double *y, double u)
+{
+    double a = u*(u - 1.);
+    double b = (u - 2.)*(u - 3.);
+    return -(u - 1.)*b/6.*y[0] + u*b/2.*y[1] - a*(u - 3.)/2.*y[2]
+        + a*(u - 2.)/6.*y[3];
+}
+
+/* keep ra continuous where it wraps through 0h */
+static void unwrap_ra(double *ra, int n)
+{
+    for (int i = 1; i < n; i++)
+    {
+        while (ra[i] - ra[i - 1] > 180.)
+            ra[i] -= 360.;
+        while (ra[i] - ra[i - 1] < -180.)
+            ra[i] += 360.;
+    }
+}
+
+void moon_series_span(const struct ephem_night *night, int status,
+        double step, double *start_jd, int32_t *samples)
+{
+    *start_jd = night->sun_set.jd;
+    *samples = 0;
+    if (status & (VNIGHT_SUN_CIRCUMPOLAR | VNIGHT_BAD_DATE) || step <= 0.)
+        return;
+
+    /* the night ends at the first sun rise after the set. sites east of
+       VERITAS set late in the UT day and rise early in it, the next rise
+       is then taken as a day after this one. */
+    double end_jd = night->sun_rise.jd;
+    if (end_jd < *start_jd)
+        end_jd += 1.;
+
+    *samples = (int32_t)floor((end_jd - *start_jd)/step) + 1;
+}
+
+int get_moon_series(double start_jd, double step, int32_t samples,
+        const struct ln_lnlat_posn *observer, struct moon_sample *series)
+{
+    if (samples <= 0)
+        return VNIGHT_OK;
+
+    const double h = VNIGHT_SERIES_NODE_STEP;
+    int spans = (int)ceil((samples - 1)*step/h);
+    if (spans < 1)
+        spans = 1;
+    int nodes = spans + 3;
+    if (nodes > SERIES_MAX_NODES)
+        return VNIGHT_OUT_OF_RANGE;
+
+    double moon_ra[SERIES_MAX_NODES], moon_dec[SERIES_MAX_NODES];
+    double sun_ra[SERIES_MAX_NODES], sun_dec[SERIES_MAX_NODES];
+    double illum[SERIES_MAX_NODES];
+    double first_node = start_jd - h;
+    for (int j = 0; j < nodes; j++)
+    {
+        double jd = first_node + j*h;
+        struct ln_equ_posn posn;
+        vnight_moon_equ_coords(jd, &posn);
+        moon_ra[j] = posn.ra;
+        moon_dec[j] = posn.dec;
+        ln_get_solar_equ_coords(jd, &posn);
+        VNIGHT_COUNT(VNIGHT_STAT_SOLAR_POSITIONS);
+        sun_ra[j] = posn.ra;
+        sun_dec[j] = posn.dec;
+        illum[j] = vnight_moon_disk(jd);
+    }
+    unwrap_ra(moon_ra, nodes);
+    unwrap_ra(sun_ra, nodes);
+
+    double sidereal = ln_get_apparent_sidereal_time(start_jd)*15.;
+    double lat = ln_deg_to_rad(observer->lat);
+    double sin_lat = sin(lat);
+    double cos_lat = cos(lat);
+
+    for (int32_t i = 0; i < samples; i++)
+    {
+        double t = i*step;
+        double x = (t + h)/h;
+        int k = (int)floor(x) - 1;
+        if (k < 0)
+            k = 0;
+        else if (k > nodes - 4)
+            k = nodes - 4;
+        double u = x - k;
+
+        double ra = ln_deg_to_rad(lagrange4(&moon_ra[k], u));
+        double dec = ln_deg_to_rad(lagrange4(&moon_dec[k], u));
+        double ra_sun = ln_deg_to_rad(lagrange4(&sun_ra[k], u));
+        double dec_sun = ln_deg_to_rad(lagrange4(&sun_dec[k], u));
+
+        double ha = ln_deg_to_rad(sidereal + sidereal_rate*t + observer->lng)
+            - ra;
+        double sin_alt = sin_lat*sin(dec) + cos_lat*cos(dec)*cos(ha);
+        double cos_sep = sin(dec)*sin(dec_sun)
+            + cos(dec)*cos(dec_sun)*cos(ra - ra_sun);
+        if (cos_sep > 1.)
+            cos_sep = 1.;
+        else if (cos_sep < -1.)
+            cos_sep = -1.;
+
+        series[i].alt = (float)ln_rad_to_deg(asin(sin_alt));
+        series[i].illum = (float)lagrange4(&illum[k], u);
+        series[i].sun_separation = (float)ln_rad_to_deg(acos(cos_sep));
+    }
+
+    return VNIGHT_OK;
+}
+
+void moon_series_header_init(struct moon_series_header *header,
+        const struct vnight_site *site, double start_mjd, int32_t nights,
+        double step)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, VNIGHT_SERIES_MAGIC, sizeof(header->magic));
+    header->header_size = sizeof(struct moon_series_header);
+    header->night_size = sizeof(struct moon_series_night);
+    header->sample_size = sizeof(struct moon_sample);
+    header->nights = nights;
+    header->start_mjd = start_mjd;
+    header->step = step;
+    header->latitude = site->latitude;
+    header->longitude = site->longitude;
+    header->horizon_begin = site->horizon_begin;
+    header->horizon_end = site->horizon_end;
+}
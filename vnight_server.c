@@ -0,0 +1,427 @@
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libnova/julian_day.h"
+
+#include "vnight.h"
+
+/* nights answered over a unix socket by a process that stays up, so a
+   query costs a lookup in the nights it already solved rather than the
+   start of a new vnight. the server is a single thread, libnova is not
+   reentrant, and clients are taken a request at a time. */
+
+#define SERVER_MAX_CLIENTS 64
+/* records written to a client at once */
+#define SERVER_CHUNK 256
+/* seconds a client has to send the rest of a request it started */
+#define SERVER_READ_TIMEOUT 5
+/* seconds a client may leave its reply unread before it is dropped. the
+   server has the one thread, a client that stops reading would otherwise
+   hold up every other client. */
+#define SERVER_WRITE_TIMEOUT 5
+
+/* hash of the integer part of mjd into n_buckets, a power of two */
+static size_t lru_bucket(const struct night_lru *lru, double mjd)
+{
+    uint64_t k = (uint64_t)(int64_t)floor(mjd);
+    return (size_t)((k*0x9e3779b97f4a7c15ull) >> 32) & (lru->n_buckets - 1);
+}
+
+int night_lru_init(struct night_lru *lru, size_t capacity)
+{
+    memset(lru, 0, sizeof(*lru));
+    if (capacity < 1)
+        capacity = 1;
+    if (capacity > INT32_MAX/2)
+        return VNIGHT_OUT_OF_RANGE;
+
+    lru->n_buckets = 1;
+    while (lru->n_buckets < 2*capacity)
+        lru->n_buckets *= 2;
+    lru->entries = malloc(capacity*sizeof(*lru->entries));
+    lru->buckets = malloc(lru->n_buckets*sizeof(*lru->buckets));
+    if (lru->entries == NULL || lru->buckets == NULL)
+    {
+        night_lru_free(lru);
+        return VNIGHT_NO_MEMORY;
+    }
+    for (size_t i = 0; i < lru->n_buckets; i++)
+        lru->buckets[i] = -1;
+    lru->capacity = capacity;
+    lru->head = lru->tail = -1;
+
+    return VNIGHT_OK;
+}
+
+void night_lru_free(struct night_lru *lru)
+{
+    free(lru->entries);
+    free(lru->buckets);
+    memset(lru, 0, sizeof(*lru));
+}
+
+static void lru_unlink(struct night_lru *lru, int32_t i)
+{
+    struct night_lru_entry *e = &(lru->entries[i]);
+    if (e->prev >= 0)
+        lru->entries[e->prev].next = e->next;
+    else
+        lru->head = e->next;
+    if (e->next >= 0)
+        lru->entries[e->next].prev = e->prev;
+    else
+        lru->tail = e->prev;
+}
+
+static void lru_push_front(struct night_lru *lru, int32_t i)
+{
+    struct night_lru_entry *e = &(lru->entries[i]);
+    e->prev = -1;
+    e->next = lru->head;
+    if (lru->head >= 0)
+        lru->entries[lru->head].prev = i;
+    lru->head = i;
+    if (lru->tail < 0)
+        lru->tail = i;
+}
+
+static int32_t lru_find(const struct night_lru *lru, double mjd)
+{
+    for (int32_t i = lru->buckets[lru_bucket(lru, mjd)]; i >= 0;
+            i = lru->entries[i].chain)
+    {
+        if (lru->entries[i].mjd == mjd)
+            return i;
+    }
+    return -1;
+}
+
+int night_lru_get(struct night_lru *lru, double mjd,
+        struct ephem_table_record *record)
+{
+    int32_t i = lru_find(lru, mjd);
+    if (i < 0)
+        return 0;
+
+    *record = lru->entries[i].record;
+    if (lru->head != i)
+    {
+        lru_unlink(lru, i);
+        lru_push_front(lru, i);
+    }
+    return 1;
+}
+
+void night_lru_put(struct night_lru *lru, double mjd,
+        const struct ephem_table_record *record)
+{
+    int32_t i = lru_find(lru, mjd);
+    if (i >= 0)
+    {
+        lru->entries[i].record = *record;
+        lru_unlink(lru, i);
+        lru_push_front(lru, i);
+        return;
+    }
+
+    if (lru->n < lru->capacity)
+        i = (int32_t)lru->n++;
+    else
+    {
+        /* reuse the least recently used entry, taking it out of its
+           bucket first */
+        i = lru->tail;
+        lru_unlink(lru, i);
+        int32_t *link = &(lru->buckets[lru_bucket(lru, lru->entries[i].mjd)]);
+        while (*link != i)
+            link = &(lru->entries[*link].chain);
+        *link = lru->entries[i].chain;
+    }
+
+    struct night_lru_entry *e = &(lru->entries[i]);
+    e->mjd = mjd;
+    e->record = *record;
+    size_t b = lru_bucket(lru, mjd);
+    e->chain = lru->buckets[b];
+    lru->buckets[b] = i;
+    lru_push_front(lru, i);
+}
+
+/* 0 once all n bytes are read, 1 if the peer closed before the first
+   byte, -1 on an error or a peer that closed part way */
+static int read_all(int fd, void *data, size_t n, volatile int *stop)
+{
+    char *p = data;
+    size_t done = 0;
+    while (done < n)
+    {
+        ssize_t r = read(fd, p + done, n - done);
+        if (r < 0 && errno == EINTR && (stop == NULL || !*stop))
+            continue;
+        if (r == 0 && done == 0)
+            return 1;
+        if (r <= 0)
+            return -1;
+        done += r;
+    }
+    return 0;
+}
+
+/* 0 once all n bytes are written, -1 on an error or, when fd has a send
+   timeout, a peer that took none of them in that time */
+static int write_all(int fd, const void *data, size_t n)
+{
+    const char *p = data;
+    while (n > 0)
+    {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int write_reply_header(int fd, int status, uint32_t records)
+{
+    struct vnight_reply_header reply;
+    memset(&reply, 0, sizeof(reply));
+    memcpy(reply.magic, VNIGHT_REPLY_MAGIC, sizeof(reply.magic));
+    reply.status = status;
+    reply.records = records;
+    return write_all(fd, &reply, sizeof(reply));
+}
+
+/* record of the night at mjd, from lru or solved and kept there */
+static void server_night(const struct vnight_site *site,
+        struct night_ephemeris *eph, struct night_sequence *seq,
+        struct night_lru *lru, double mjd, struct ephem_table_record *record)
+{
+    if (night_lru_get(lru, mjd, record))
+    {
+        VNIGHT_COUNT(VNIGHT_STAT_NIGHT_CACHE_HITS);
+        return;
+    }
+    VNIGHT_COUNT(VNIGHT_STAT_NIGHT_CACHE_MISSES);
+
+    /* mjd is at 0h UT, convert back to a calendar date */
+    struct ln_date date;
+    ln_get_date(mjd + 2400000.5, &date);
+    struct ephem_night night;
+    int status;
+    get_night_ephem_sites(eph, site, 1, seq, date.years, date.months,
+            date.days, &night, &status);
+    ephem_table_record_from_night(&night, status, record);
+    night_lru_put(lru, mjd, record);
+}
+
+/* answer one request on fd. returns 0 to keep the connection, non-zero
+   to close it. */
+static int serve_request(int fd, const struct vnight_site *site,
+        struct night_ephemeris *eph, struct night_sequence *seq,
+        struct night_lru *lru, volatile int *stop)
+{
+    struct vnight_request_header request;
+    if (read_all(fd, &request, sizeof(request), stop) != 0 ||
+            memcmp(request.magic, VNIGHT_REQUEST_MAGIC,
+                sizeof(request.magic)) != 0)
+        return 1;
+    if (request.queries > VNIGHT_SERVER_MAX_QUERIES)
+    {
+        write_reply_header(fd, VNIGHT_OUT_OF_RANGE, 0);
+        return 1;
+    }
+
+    struct vnight_query queries[VNIGHT_SERVER_MAX_QUERIES];
+    if (read_all(fd, queries, request.queries*sizeof(queries[0]), stop)
+            != 0)
+        return 1;
+
+    /* the whole request is checked before any record is sent, so a reply
+       is either every record or none */
+    uint64_t records = 0;
+    for (uint32_t q = 0; q < request.queries; q++)
+    {
+        double mjd = queries[q].start_mjd;
+        if (!(fabs(mjd) < 1e7) || mjd != floor(mjd) || queries[q].nights < 0)
+            return write_reply_header(fd, VNIGHT_BAD_DATE, 0);
+        records += queries[q].nights;
+    }
+    if (records > VNIGHT_SERVER_MAX_NIGHTS)
+        return write_reply_header(fd, VNIGHT_OUT_OF_RANGE, 0);
+
+    if (write_reply_header(fd, VNIGHT_OK, (uint32_t)records) != 0)
+        return 1;
+
+    struct ephem_table_record chunk[SERVER_CHUNK];
+    int n = 0;
+    for (uint32_t q = 0; q < request.queries; q++)
+    {
+        for (int32_t i = 0; i < queries[q].nights; i++)
+        {
+            server_night(site, eph, seq, lru, queries[q].start_mjd + i,
+                    &chunk[n++]);
+            if (n == SERVER_CHUNK)
+            {
+                if (write_all(fd, chunk, sizeof(chunk)) != 0)
+                    return 1;
+                n = 0;
+            }
+        }
+    }
+    if (n > 0 && write_all(fd, chunk, n*sizeof(chunk[0])) != 0)
+        return 1;
+
+    return 0;
+}
+
+int vnight_serve(const char *path, const struct vnight_site *site,
+        struct night_ephemeris *eph, struct night_sequence *seq,
+        struct night_lru *lru, volatile int *stop)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return VNIGHT_FILE_ERROR;
+    strcpy(addr.sun_path, path);
+
+    /* a socket left by a server that did not shut down is replaced, any
+       other file is not */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        return VNIGHT_FILE_ERROR;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(listener, SERVER_MAX_CLIENTS) != 0)
+    {
+        close(listener);
+        return VNIGHT_FILE_ERROR;
+    }
+
+    struct pollfd fds[SERVER_MAX_CLIENTS + 1];
+    int n_fds = 1;
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+
+    while (!*stop)
+    {
+        /* wake up now and then to see if *stop was set */
+        int ready = poll(fds, n_fds, 1000);
+        if (ready <= 0)
+            continue;
+
+        for (int i = n_fds - 1; i >= 1; i--)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            if ((fds[i].revents & POLLIN) == 0 ||
+                    serve_request(fds[i].fd, site, eph, seq, lru, stop) != 0)
+            {
+                close(fds[i].fd);
+                fds[i] = fds[--n_fds];
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept(listener, NULL, NULL);
+            if (client >= 0 && n_fds == SERVER_MAX_CLIENTS + 1)
+                close(client);
+            else if (client >= 0)
+            {
+                struct timeval timeout = {SERVER_READ_TIMEOUT, 0};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                        sizeof(timeout));
+                struct timeval send_timeout = {SERVER_WRITE_TIMEOUT, 0};
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &send_timeout,
+                        sizeof(send_timeout));
+                fds[n_fds].fd = client;
+                fds[n_fds].events = POLLIN;
+                fds[n_fds].revents = 0;
+                n_fds++;
+            }
+        }
+    }
+
+    for (int i = 0; i < n_fds; i++)
+        close(fds[i].fd);
+    unlink(path);
+
+    return VNIGHT_OK;
+}
+
+int vnight_query(const char *path, const struct vnight_query *queries,
+        uint32_t n_queries, struct ephem_table_record **records,
+        uint32_t *n_records)
+{
+    *records = NULL;
+    *n_records = 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return VNIGHT_FILE_ERROR;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return VNIGHT_FILE_ERROR;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return VNIGHT_FILE_ERROR;
+    }
+
+    struct vnight_request_header request;
+    memcpy(request.magic, VNIGHT_REQUEST_MAGIC, sizeof(request.magic));
+    request.queries = n_queries;
+    struct vnight_reply_header reply;
+    if (write_all(fd, &request, sizeof(request)) != 0 ||
+            write_all(fd, queries, n_queries*sizeof(queries[0])) != 0 ||
+            read_all(fd, &reply, sizeof(reply), NULL) != 0 ||
+            memcmp(reply.magic, VNIGHT_REPLY_MAGIC, sizeof(reply.magic)) != 0)
+    {
+        close(fd);
+        return VNIGHT_FILE_ERROR;
+    }
+    if (reply.status != VNIGHT_OK)
+    {
+        close(fd);
+        return reply.status;
+    }
+
+    *records = malloc((reply.records > 0 ? reply.records : 1)*
+            sizeof(struct ephem_table_record));
+    if (*records == NULL)
+    {
+        close(fd);
+        return VNIGHT_NO_MEMORY;
+    }
+    if (read_all(fd, *records, reply.records*sizeof(**records), NULL) != 0)
+    {
+        free(*records);
+        *records = NULL;
+        close(fd);
+        return VNIGHT_FILE_ERROR;
+    }
+    *n_records = reply.records;
+    close(fd);
+
+    return VNIGHT_OK;
+}
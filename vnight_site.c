@@ -0,0 +1,105 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vnight.h"
+
+/* observing site definitions, so that one vnight binary schedules any
+   site. a site file looks like
+
+   # VERITAS, FLWO
+   name = VERITAS
+   latitude = 31.675
+   longitude = -110.952
+   horizon_begin = -16.5
+   horizon_end = -15
+   utc_offset = -7 */
+
+/* strip leading and trailing white space in place */
+static char *strip(char *str)
+{
+    while (isspace((unsigned char)*str))
+        str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1]))
+        *--end = '\0';
+    return str;
+}
+
+static int parse_number(const char *str, double *value)
+{
+    char *end;
+    *value = strtod(str, &end);
+    return end != str && *end == '\0';
+}
+
+int vnight_site_read(const char *path, struct vnight_site *site)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return VNIGHT_FILE_ERROR;
+
+    *site = veritas_site;
+
+    int ok = 1;
+    char line[256];
+    while (ok && fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *comment = strchr(line, '#');
+        if (comment != NULL)
+            *comment = '\0';
+        char *key = strip(line);
+        if (*key == '\0')
+            continue;
+
+        char *equals = strchr(key, '=');
+        if (equals == NULL)
+        {
+            ok = 0;
+            break;
+        }
+        *equals = '\0';
+        char *value = strip(equals + 1);
+        key = strip(key);
+
+        double number;
+        if (strcmp(key, "name") == 0)
+        {
+            ok = *value != '\0' && strlen(value) < sizeof(site->name);
+            if (ok)
+                strcpy(site->name, value);
+        }
+        else if (!parse_number(value, &number))
+            ok = 0;
+        else if (strcmp(key, "latitude") == 0)
+        {
+            site->latitude = number;
+            ok = number >= -90. && number <= 90.;
+        }
+        else if (strcmp(key, "longitude") == 0)
+        {
+            site->longitude = number;
+            ok = number >= -180. && number <= 360.;
+        }
+        else if (strcmp(key, "horizon_begin") == 0)
+            site->horizon_begin = number;
+        else if (strcmp(key, "horizon_end") == 0)
+            site->horizon_end = number;
+        else if (strcmp(key, "utc_offset") == 0)
+        {
+            /* to the second, like the time zones of ln_zonedate */
+            site->utc_offset = (long)(number*3600. +
+                    (number < 0 ? -0.5 : 0.5));
+            ok = number >= -14. && number <= 14.;
+        }
+        else
+            ok = 0;
+    }
+
+    fclose(fp);
+    if (!ok)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
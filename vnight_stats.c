@@ -0,0 +1,111 @@
+#include <string.h>
+#include <time.h>
+
+#include "vnight.h"
+
+/* counters and timers of the hot paths, see vnight.h. this file is the
+   same with and without VNIGHT_STATS; without it nothing ever adds to the
+   counts and they stay zero. */
+
+__thread struct vnight_stats vnight_thread_stats;
+
+/* when the counts were last reset, for vnight_ticks_per_second */
+static __thread double reset_seconds;
+static __thread uint64_t reset_ticks;
+
+static const char *counter_names[VNIGHT_STAT_COUNTERS] =
+{
+    "nights",
+    "solar_positions",
+    "lunar_positions",
+    "rst_solves",
+    "seq_iterations",
+    "roots_iterations",
+    "position_hits",
+    "position_misses",
+    "night_cache_hits",
+    "night_cache_misses",
+    "seq_fallbacks",
+    "next_day_events",
+    "moon_circumpolar",
+    "sun_circumpolar"
+};
+
+static const char *timer_names[VNIGHT_STAT_TIMERS] =
+{
+    "get_moon_rise_set",
+    "get_sun_rise_set",
+    "get_moon_alt_and_illum",
+    "get_night_ephem_roots",
+    "output"
+};
+
+static double monotonic_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+int vnight_stats_enabled(void)
+{
+#ifdef VNIGHT_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void vnight_stats_reset(void)
+{
+    memset(&vnight_thread_stats, 0, sizeof(vnight_thread_stats));
+    reset_seconds = monotonic_seconds();
+#ifdef VNIGHT_STATS
+    reset_ticks = vnight_ticks();
+#endif
+}
+
+void vnight_stats_add(struct vnight_stats *sum,
+        const struct vnight_stats *stats)
+{
+    for (int i = 0; i < VNIGHT_STAT_COUNTERS; i++)
+        sum->count[i] += stats->count[i];
+    for (int i = 0; i < VNIGHT_STAT_TIMERS; i++)
+    {
+        sum->calls[i] += stats->calls[i];
+        sum->ticks[i] += stats->ticks[i];
+    }
+}
+
+double vnight_ticks_per_second(void)
+{
+#if defined(VNIGHT_STATS) && (defined(__x86_64__) || defined(__i386__))
+    /* the timestamp counter is measured against the monotonic clock over
+       at least a few milliseconds */
+    double seconds;
+    uint64_t ticks;
+    do
+    {
+        seconds = monotonic_seconds() - reset_seconds;
+        ticks = vnight_ticks() - reset_ticks;
+    } while (seconds < 0.005);
+    return ticks/seconds;
+#else
+    (void)reset_ticks;
+    return 1e9;
+#endif
+}
+
+const char *vnight_counter_name(int counter)
+{
+    if (counter < 0 || counter >= VNIGHT_STAT_COUNTERS)
+        return "unknown";
+    return counter_names[counter];
+}
+
+const char *vnight_timer_name(int timer)
+{
+    if (timer < 0 || timer >= VNIGHT_STAT_TIMERS)
+        return "unknown";
+    return timer_names[timer];
+}
@@ -0,0 +1,151 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vnight.h"
+
+/* fixed record binary tables of computed nights. tools that only need the
+   events map the file and index it by night instead of running the
+   ephemeris again. */
+
+void ephem_table_record_from_night(const struct ephem_night *night,
+        int status, struct ephem_table_record *record)
+{
+    const struct ephem_data *events[4] = {&(night->sun_set),
+        &(night->sun_rise), &(night->moon_set), &(night->moon_rise)};
+
+    for (int e = 0; e < 4; e++)
+    {
+        record->event[e].jd = events[e]->jd;
+        record->event[e].moon_illum = events[e]->moon_illum;
+        record->event[e].moon_alt = events[e]->moon_alt;
+    }
+    record->status = status;
+    record->reserved = 0;
+}
+
+void ephem_night_from_table_record(const struct ephem_table_record *record,
+        struct ephem_night *night)
+{
+    struct ephem_data *events[4] = {&(night->sun_set), &(night->sun_rise),
+        &(night->moon_set), &(night->moon_rise)};
+
+    /* events the solvers did not fill in are zero, date and all, as in
+       get_night_ephem */
+    memset(night, 0, sizeof(*night));
+    for (int e = 0; e < 4; e++)
+    {
+        events[e]->jd = record->event[e].jd;
+        events[e]->moon_illum = record->event[e].moon_illum;
+        events[e]->moon_alt = record->event[e].moon_alt;
+        strcpy(events[e]->label, vnight_event_label(e));
+    }
+}
+
+void ephem_table_header_init(struct ephem_table_header *header,
+        const struct vnight_site *site, double start_mjd, int32_t nights)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, VNIGHT_TABLE_MAGIC, sizeof(header->magic));
+    header->header_size = sizeof(struct ephem_table_header);
+    header->record_size = sizeof(struct ephem_table_record);
+    header->nights = nights;
+    header->start_mjd = start_mjd;
+    header->latitude = site->latitude;
+    header->longitude = site->longitude;
+    header->horizon_begin = site->horizon_begin;
+    header->horizon_end = site->horizon_end;
+}
+
+int ephem_table_write(const char *path, const struct vnight_site *site,
+        double start_mjd, int32_t nights,
+        const struct ephem_table_record *records)
+{
+    struct ephem_table_header header;
+    ephem_table_header_init(&header, site, start_mjd, nights);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return VNIGHT_FILE_ERROR;
+
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(records, sizeof(*records), nights, fp) == (size_t)nights;
+
+    if (fclose(fp) != 0 || !ok)
+        return VNIGHT_FILE_ERROR;
+
+    return VNIGHT_OK;
+}
+
+int ephem_table_map(const char *path, const struct vnight_site *site,
+        struct ephem_table *table)
+{
+    memset(table, 0, sizeof(*table));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return VNIGHT_FILE_ERROR;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+            (size_t)st.st_size < sizeof(struct ephem_table_header))
+    {
+        close(fd);
+        return VNIGHT_FILE_ERROR;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return VNIGHT_FILE_ERROR;
+
+    const struct ephem_table_header *header = map;
+    size_t size = st.st_size;
+    if (memcmp(header->magic, VNIGHT_TABLE_MAGIC, sizeof(header->magic)) != 0
+            || header->header_size != sizeof(struct ephem_table_header)
+            || header->record_size != sizeof(struct ephem_table_record)
+            || header->nights < 0
+            || size < header->header_size +
+                (size_t)header->nights*header->record_size)
+    {
+        munmap(map, size);
+        return VNIGHT_FILE_ERROR;
+    }
+
+    /* a table is only good for the site and twilight it was made for */
+    if (header->latitude != site->latitude ||
+            header->longitude != site->longitude ||
+            header->horizon_begin != site->horizon_begin ||
+            header->horizon_end != site->horizon_end)
+    {
+        munmap(map, size);
+        return VNIGHT_STALE_TABLE;
+    }
+
+    table->header = header;
+    table->records = (const struct ephem_table_record *)
+        ((const char *)map + header->header_size);
+    table->size = size;
+
+    return VNIGHT_OK;
+}
+
+void ephem_table_unmap(struct ephem_table *table)
+{
+    if (table->header != NULL)
+        munmap((void *)table->header, table->size);
+    memset(table, 0, sizeof(*table));
+}
+
+const struct ephem_table_record *ephem_table_night(
+        const struct ephem_table *table, double mjd)
+{
+    double i = mjd - table->header->start_mjd;
+    if (i < 0. || i >= table->header->nights)
+        return NULL;
+
+    return &(table->records[(int32_t)i]);
+}
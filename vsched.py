@@ -1,19 +1,96 @@
 #!/usr/bin/env python
 
 import argparse
+import array
+import bisect
+import collections
+from concurrent.futures import ThreadPoolExecutor
 import datetime
+import io
+import itertools
+import math
+import mmap
+import os
 import re
+import socket
 from string import Formatter
+import struct
 import subprocess
 import sys
 from zoneinfo import ZoneInfo
 
+# optional compiled libvnight module. when it is available nights are
+# computed in-process instead of by running the --night-program executable.
+try:
+    import _vnight
+except ImportError:
+    _vnight = None
+
+# optional numpy, used to classify many nights at once in sweep mode
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
 # parameters that determine what is a dark run night, when to transition to
 # RHV, moon, or SHV modes
 default_max_rhv_phase  = 0.666
 default_max_moon_phase = 0.300
 default_minimum_interval = 2
 
+# vnight -l prints times in MST, which is also the time zone used for times
+# computed from julian dates returned by _vnight
+mst = datetime.timezone(datetime.timedelta(hours=-7))
+unix_epoch = datetime.datetime(1970, 1, 1, tzinfo=datetime.UTC)
+unix_epoch_jd = 2440587.5
+
+# site and twilight angles vnight computes for, see vnight.h. a night table
+# made for anything else is stale.
+veritas_latitude = 31.675
+veritas_longitude = -110.952
+horizon_angle_begin = -16.5
+horizon_angle_end = -15.
+
+# layout of vnight binary night tables (vnight -t), struct ephem_table_header
+# and struct ephem_table_record in vnight.h
+table_magic = b'VNTABLE1'
+table_header = struct.Struct('<8sIIiid4d')
+table_record = struct.Struct('<12dii')
+mjd_epoch = datetime.date(1858, 11, 17)
+
+# vnight --cache keeps a table per UT year in a directory named for the
+# results in it, see ephem_cache_key in vnight_cache.c. the name has the
+# libnova version of the night program in it, so vsched.py asks the
+# night program for it with --cache-key. only the tables of the default
+# solver, or of --roots, are read.
+status_not_cached = 128
+
+# vnight --serve protocol (--server), struct vnight_request_header,
+# struct vnight_query and struct vnight_reply_header in vnight.h. the reply
+# header is followed by a table record per night.
+request_magic = b'VNQ1'
+reply_magic = b'VNR1'
+request_header = struct.Struct('<4sI')
+server_query = struct.Struct('<dii')
+reply_header = struct.Struct('<4siII')
+
+# run period index (--run-index). the header has the first UT date of the
+# season as an mjd, its number of nights, and the minimum interval in
+# hours the nights were classified with. each period record is the offset
+# of its first night from the start of the season, its number of nights,
+# its type, and its run number. periods are in date order and cover every
+# night of the season.
+run_index_magic = b'VRUNIDX1'
+run_index_header = struct.Struct('<8sIIiidd')
+run_index_record = struct.Struct('<iiii')
+run_types = ('DR', 'BR')
+
+def jd_to_datetime(jd):
+    """Convert a julian date to a datetime in MST. Seconds are rounded to
+    0.1 ms, the precision of the vnight CSV output."""
+    seconds = round((jd - unix_epoch_jd)*86400., 4)
+    return (unix_epoch + datetime.timedelta(seconds=seconds)).astimezone(mst)
+
 def strfdelta(tdelta, fmt='{D:02}d {H:02}h {M:02}m {S:02}s', inputtype='datetime.timedelta'):
     """Convert a datetime.timedelta object or a regular number to a custom-
     formatted string, just like the stftime() method does for datetime.datetime
@@ -71,13 +148,25 @@ class event:
         self.moon_frac = fraction
         self.moon_alt = alt
         self.label = label
+        self.formatted = {}
+    def strftime(self, fmt, utc=False):
+        """dt, or dt in UTC, formatted with fmt. a night formats the same
+        event for several of its outputs, so the text is kept."""
+        text = self.formatted.get((fmt, utc))
+        if text is None:
+            dt = self.dt.astimezone(datetime.UTC) if utc else self.dt
+            text = self.formatted[(fmt, utc)] = dt.strftime(fmt)
+        return text
     def __lt__(self, other):
         return self.dt < other.dt
     def __str__(self):
         return self.label + ' ' + self.dt.strftime('%Y-%m-%d %H:%M') + \
             ' (' + str(self.moon_frac) + ')'
 class vephem:
-    def __init__(self, string):
+    def __init__(self, string, events=None):
+        """Build the night from a line of vnight CSV output, or from events,
+        a (sunset, sunrise, moonset, moonrise) tuple of event objects, in
+        which case string is ignored."""
         self.sunset = None
         self.sunrise = None
         self.moonset = None
@@ -106,7 +195,10 @@ class vephem:
         # values are DR or BR
         self.night_type = None
 
-        self.parse_string(string)
+        if events is None:
+            self.parse_string(string)
+        else:
+            self.sunset, self.sunrise, self.moonset, self.moonrise = events
         # list of events sorted by time order
         self.slist = sorted([self.sunset, self.sunrise, self.moonset,
                              self.moonrise])
@@ -136,7 +228,7 @@ class vephem:
         event times: sun rise, sun set, moon rise, moon set."""
         tokens = string.split(',')
         if len(tokens) != 12:
-            raise RuntimeException(f'Bad line, wrong number of fields: {string}')
+            raise RuntimeError(f'Bad line, wrong number of fields: {string}')
         self.sunset = event(datetime.datetime.fromisoformat(tokens[0]),
                             float(tokens[1]), float(tokens[2]), 'sunset')
         self.sunrise = event(datetime.datetime.fromisoformat(tokens[3]),
@@ -161,13 +253,13 @@ class vephem:
         # next event is moon rise, moon set, or sunrise
         i += 1
         if i >= 4:
-            raise RuntimeException('index out of bounds')
+            raise RuntimeError('index out of bounds')
         if self.slist[i].label == 'moonrise' or \
                 self.slist[i].label == 'moonset':
             self.moon_event = self.slist[i]
             i += 1
             if i >= 4:
-                raise RuntimeException('index out of bounds')
+                raise RuntimeError('index out of bounds')
             self.begin_twilight = self.slist[i]
 
         # if begin_twilight is still not assigned then the event
@@ -314,9 +406,9 @@ class vephem:
                 self.start_moon = self.sunset
                 self.end_moon   = self.sunrise
                 if max(self.sunset.moon_frac, self.sunrise.moon_frac) < max_moon_phase:
-                    self.moon_or_rhv = moon
+                    self.moon_or_rhv = 'moon'
                 elif max(self.sunset.moon_frac, self.sunrise.moon_frac) < max_rhv_phase:
-                    self.moon_or_rhv = rhv
+                    self.moon_or_rhv = 'rhv'
                 else:
                     self.moon_or_rhv = None
             # moon sets before sunset, so no moon time
@@ -331,9 +423,9 @@ class vephem:
                 self.start_moon = self.sunset
                 self.end_moon = self.sunrise
                 if max(self.sunset.moon_frac, self.sunrise.moon_frac) < max_moon_phase:
-                    self.moon_or_rhv = moon
+                    self.moon_or_rhv = 'moon'
                 elif max(self.sunset.moon_frac, self.sunrise.moon_frac) < max_rhv_phase:
-                    self.moon_or_rhv = rhv
+                    self.moon_or_rhv = 'rhv'
                 else:
                     self.moon_or_rhv = None
             else:
@@ -384,111 +476,592 @@ class vephem:
         else:
             self.night_type = 'BR'
 
-    def print_ical_event(self, season, night_type, run_number,
-                         run_night_number):
-        """Generate output suitable for use in Google Calendar."""
-        print('BEGIN:VEVENT\r')
-        print('DTSTAMP:{0}\r'.format(datetime.datetime.now(datetime.UTC).strftime('%Y%m%dT%H%M%SZ')))
-        print('SUMMARY:{0}{1}-{2}\r'.format(night_type, run_number,
-                                            run_night_number))
-        print('UID:{0}-{1}{2}-{3}@veritas.sao.arizona.edu\r'.format(season,
-                                    night_type, run_number, run_night_number))
-        print('STATUS:CONFIRMED\r')
-        print('TRANSP:TRANSPARENT\r')
-        print('DTSTART:{0}\r'.format(self.sunset.dt.strftime('%Y%m%d')))
-        print('DTEND:{0}\r'.format(self.sunset.dt.strftime('%Y%m%d')))
-        print('CATEGORIES:VERITAS,OBSERVING\r')
-        print('LOCATION:FLWO\r')
-        print('GEO:31.675;-110.952222\r')
-        print('DESCRIPTION:', end='')
-        print('UT date: {0}\\n\r'.format(self.sunset.dt.astimezone(ZoneInfo('UTC')).strftime('%Y-%b-%d')))
-        print(' following times are MST\\n\r')
-        print(' Sunset: {0}\\n\r'.format(self.sunset.dt.strftime('%Y-%b-%d %H:%M')))
-        print(' Sunrise: {0}\\n\r'.format(self.sunrise.dt.strftime('%Y-%b-%d %H:%M')))
-        if self.start_dark is not None and self.end_dark is not None:
-            print(' Start of dark: {0}\\n\r'.format(self.start_dark.dt.strftime('%Y-%b-%d %H:%M')))
-            print(' End of dark: {0}\\n\r'.format(self.end_dark.dt.strftime('%Y-%b-%d %H:%M')))
-        if self.moon_or_rhv is not None:
-            print(' Moontime check currents max. 15 uA\\n\r')
-            print(' Start of moon ({0:5.2f}%): {1}\\n\r'.format(self.start_moon.moon_frac*100, self.start_moon.dt.strftime('%Y-%b-%d %H:%M')))
-            print(' End of moon ({0:5.2f}%): {1}\\n\r'.format(self.end_moon.moon_frac*100, self.end_moon.dt.strftime('%Y-%b-%d %H:%M')))
-
-        print('END:VEVENT\r')
-
-    def print_wiki_event(self, run_number, run_night_number):
-        print('<TR>')
-        print(f'  <TD>{run_number}</TD>')
-        print(f'  <TD>{run_night_number}</TD>')
-        print('  <TD>{0}</TD>'.format(self.sunset.dt.strftime('%Y-%b-%d')))
-        print('  <TD>{0}</TD>'.format(self.start_night.dt.strftime('%Y-%b-%d %H:%M')))
-        print('  <TD>{0}</TD>'.format(self.end_night.dt.strftime('%Y-%b-%d %H:%M')))
-        print('</TR>')
-
-    def print_schedule(self, night_type, run_night, run_night_number,
-                       delim=','):
-        """Generate CSV output suitable for importing into Google Sheets."""
-        sunset_ut = self.sunset.dt.astimezone(ZoneInfo('UTC'))
-        print('', end=delim) # DR label
-        # 'UTC Date'
-        print(sunset_ut.strftime('%Y-%m-%d'), end=delim)
-        # 'Start Date (MST)'
-        print(self.sunset.dt.strftime('%Y-%m-%d'), end=delim)
-        # 'DR #'
-        print(f'{night_type}{run_night:02d}-{run_night_number:02d}', end=delim)
-        print('', end=delim)  # 'Day/Holidays'
-        print('', end=delim)  # 'Day of week (MST)'
-        print('', end=delim)  # 'holiday'
-        print('', end=delim)  # 'Event Times'
-        print(self.sunset.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-        if self.moon_event is None:
-            print('', end=delim)
-            print('', end=delim)
-            print('', end=delim)
+
+# moon altitude of its rise and set in vnight, LN_LUNAR_STANDART_HORIZON
+lunar_horizon = 0.125
+# how far outside the night the moon events a window does not have are put
+outside_night = datetime.timedelta(minutes=1)
+
+class window_vephem(vephem):
+    """Night from a line of vnight --window CSV output: the sun set, the
+    next sun rise, and every moon rise and set between them. A night with
+    no moon event or one is a vephem, with the moon rise or set it does
+    not have put just outside the night where it leaves the moon as the
+    window has it. A night with a set and a rise, or a rise and a set, is
+    split into the segments the moon is up and down in. Its dark and moon
+    durations are the totals of the segments, and the start and end of
+    the dark and moon are those of the longest segment."""
+    def __init__(self, string):
+        tokens = string.split(',')
+        if len(tokens) < 7 or len(tokens) != 7 + 4*int(tokens[6]):
+            raise RuntimeError(f'Bad line, wrong number of fields: {string}')
+        sunset = event(datetime.datetime.fromisoformat(tokens[0]),
+                       float(tokens[1]), float(tokens[2]), 'sunset')
+        sunrise = event(datetime.datetime.fromisoformat(tokens[3]),
+                        float(tokens[4]), float(tokens[5]), 'sunrise')
+        self.moon_events = [event(datetime.datetime.fromisoformat(tokens[i]),
+                                  float(tokens[i + 1]), float(tokens[i + 2]),
+                                  'moon' + tokens[i + 3])
+                            for i in range(7, len(tokens), 4)]
+
+        # the moon is up at sunset if the first event sets it
+        if self.moon_events:
+            up = self.moon_events[0].label == 'moonset'
         else:
-            print(self.moon_event.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-            if self.moon_event.label == 'moonrise':
-                print('Rise', end=delim)
-            else:
-                print('Set', end=delim)
-            print('{:.2f}'.format(max(self.start_moon.moon_frac,
-                                      self.end_moon.moon_frac)*100),
-                  end=delim)
-        # Twilight Begins (MST)
-        print(self.sunrise.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-        print('', end=delim)  # 'Run Times'
-        print(self.start_night.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-        print(self.end_night.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-        if self.start_dark is not None and self.end_dark is not None:
-            print(self.start_dark.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-            print(self.end_dark.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
+            up = sunset.moon_alt >= lunar_horizon
+
+        if not self.moon_events:
+            before = event(sunset.dt - outside_night, abs(sunset.moon_frac),
+                           0., 'moonrise' if up else 'moonset')
+            after = event(sunrise.dt + outside_night, abs(sunrise.moon_frac),
+                          0., 'moonset' if up else 'moonrise')
+            moon = (before, after)
         else:
-            print('', end=delim)
-            print('', end=delim)
-        if self.moon_or_rhv is None:
-            print('', end=delim)
-            print('', end=delim)
+            first = self.moon_events[0]
+            other = 'moonrise' if first.label == 'moonset' else 'moonset'
+            moon = (first, event(sunrise.dt + outside_night,
+                                 abs(sunrise.moon_frac), 0., other))
+        moonset, moonrise = sorted(moon, key=lambda e: e.label != 'moonset')
+        super().__init__(None, (sunset, sunrise, moonset, moonrise))
+
+        if len(self.moon_events) > 1:
+            self.split_night(up)
+
+    def split_night(self, up):
+        """Dark, moon, and night of a window with more than one moon
+        event, up is whether the moon is up at sunset."""
+        bounds = [self.sunset, *self.moon_events, self.sunrise]
+        segments = {True: [], False: []}
+        for start, end in zip(bounds, bounds[1:]):
+            segments[up].append((start, end))
+            up = not up
+
+        def longest(segs):
+            return max(segs, key=lambda seg: seg[1].dt - seg[0].dt)
+        def total(segs):
+            return sum((end.dt - start.dt for start, end in segs),
+                       datetime.timedelta(0))
+
+        dark, moon = segments[False], segments[True]
+        self.start_dark, self.end_dark = longest(dark)
+        self.dark_duration = total(dark)
+        self.start_moon, self.end_moon = longest(moon)
+        self.moon_duration = total(moon)
+        # brightest moon of any segment, as find_moon does for one
+        frac = max(max(start.moon_frac, end.moon_frac) for start, end in moon)
+        if frac < max_moon_phase:
+            self.moon_or_rhv = 'moon'
+        elif frac < max_rhv_phase:
+            self.moon_or_rhv = 'rhv'
         else:
-            print(self.start_moon.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-            print(self.end_moon.dt.strftime('%Y-%m-%d %H:%M:%S'), end=delim)
-
-        print('', end=',') # 'Moon'
-        if self.moon_or_rhv == 'moon' or self.moon_or_rhv == 'rhv' and \
-                self.moon_duration > datetime.timedelta(seconds=0):
-            print('{:.2f}'.format(max(self.start_moon.moon_frac,
-                                      self.end_moon.moon_frac)*100), end=delim)
-            print(self.moon_or_rhv, end=delim)
+            self.moon_or_rhv = None
+
+        # a moon too bright for rhv leaves the night from the first dark
+        # to the last, as find_night does for one moon event
+        if frac > max_rhv_phase:
+            self.start_night, self.end_night = dark[0][0], dark[-1][1]
         else:
-            print('', end=',') # 'Moon phase'
+            self.start_night, self.end_night = self.sunset, self.sunrise
+        self.night_duration = self.end_night.dt - self.start_night.dt
+        if self.night_duration < minimum_interval:
+            self.start_night = self.sunset
+            self.end_night = self.sunrise
+
+class schedule_writer:
+    """Schedule output of one format. Each night is formatted into a
+    single string, and the nights are written to out in large chunks."""
+    chunk_size = 1 << 16
+
+    def __init__(self, out):
+        self.out = out
+        self.parts = []
+        self.size = 0
+
+    def write(self, text):
+        self.parts.append(text)
+        self.size += len(text)
+        if self.size >= self.chunk_size:
+            self.flush()
+
+    def flush(self):
+        if self.parts:
+            self.out.write(''.join(self.parts))
+            self.parts.clear()
+            self.size = 0
 
+    def begin(self):
+        pass
 
-        print('')
+    def night(self, v, night_type, run_number, run_night_number):
+        raise NotImplementedError
+
+    def end(self):
+        self.flush()
+
+class csv_writer(schedule_writer):
+    """CSV output suitable for importing into Google Sheets."""
+    def night(self, v, night_type, run_number, run_night_number):
+        time = '%Y-%m-%d %H:%M:%S'
+        fields = ['', # DR label
+                  v.sunset.strftime('%Y-%m-%d', utc=True), # 'UTC Date'
+                  v.sunset.strftime('%Y-%m-%d'), # 'Start Date (MST)'
+                  f'{night_type}{run_number:02d}-{run_night_number:02d}',
+                  '', # 'Day/Holidays'
+                  '', # 'Day of week (MST)'
+                  '', # 'holiday'
+                  '', # 'Event Times'
+                  v.sunset.strftime(time)]
+        if v.moon_event is None:
+            fields += ['', '', '']
+        else:
+            fields += [v.moon_event.strftime(time),
+                       'Rise' if v.moon_event.label == 'moonrise' else 'Set',
+                       '{:.2f}'.format(max(v.start_moon.moon_frac,
+                                           v.end_moon.moon_frac)*100)]
+        # Twilight Begins (MST), then 'Run Times'
+        fields += [v.sunrise.strftime(time), '',
+                   v.start_night.strftime(time), v.end_night.strftime(time)]
+        if v.start_dark is not None and v.end_dark is not None:
+            fields += [v.start_dark.strftime(time), v.end_dark.strftime(time)]
+        else:
+            fields += ['', '']
+        if v.moon_or_rhv is None:
+            fields += ['', '']
+        else:
+            fields += [v.start_moon.strftime(time), v.end_moon.strftime(time)]
+        fields.append('') # 'Moon'
+        if v.moon_or_rhv == 'moon' or v.moon_or_rhv == 'rhv' and \
+                v.moon_duration > datetime.timedelta(seconds=0):
+            fields += ['{:.2f}'.format(max(v.start_moon.moon_frac,
+                                           v.end_moon.moon_frac)*100),
+                       v.moon_or_rhv]
+        else:
+            fields.append('') # 'Moon phase'
+        # every field is followed by a comma, the last one too
+        self.write(','.join(fields) + ',\n')
+
+class ical_writer(schedule_writer):
+    """iCal output suitable for use with Google Calendar."""
+    def __init__(self, out, season):
+        super().__init__(out)
+        self.season = season
+        # one time stamp for the whole calendar
+        self.dtstamp = datetime.datetime.now(datetime.UTC).strftime(
+            '%Y%m%dT%H%M%SZ')
+
+    def begin(self):
+        self.write('BEGIN:VCALENDAR\r\n'
+                   'VERSION:2.0\r\n'
+                   'PRODID:-//VERITAS/Observing Calendar 2.0//EN\r\n')
+
+    def night(self, v, night_type, run_number, run_night_number):
+        local = '%Y-%b-%d %H:%M'
+        day = v.sunset.strftime('%Y%m%d')
+        lines = ['BEGIN:VEVENT',
+                 f'DTSTAMP:{self.dtstamp}',
+                 f'SUMMARY:{night_type}{run_number}-{run_night_number}',
+                 f'UID:{self.season}-{night_type}{run_number}-'
+                 f'{run_night_number}@veritas.sao.arizona.edu',
+                 'STATUS:CONFIRMED',
+                 'TRANSP:TRANSPARENT',
+                 f'DTSTART:{day}',
+                 f'DTEND:{day}',
+                 'CATEGORIES:VERITAS,OBSERVING',
+                 'LOCATION:FLWO',
+                 'GEO:31.675;-110.952222',
+                 'DESCRIPTION:UT date: '
+                 f'{v.sunset.strftime("%Y-%b-%d", utc=True)}\\n',
+                 ' following times are MST\\n',
+                 f' Sunset: {v.sunset.strftime(local)}\\n',
+                 f' Sunrise: {v.sunrise.strftime(local)}\\n']
+        if v.start_dark is not None and v.end_dark is not None:
+            lines += [f' Start of dark: {v.start_dark.strftime(local)}\\n',
+                      f' End of dark: {v.end_dark.strftime(local)}\\n']
+        if v.moon_or_rhv is not None:
+            lines += [' Moontime check currents max. 15 uA\\n',
+                      ' Start of moon ({0:5.2f}%): {1}\\n'.format(
+                          v.start_moon.moon_frac*100,
+                          v.start_moon.strftime(local)),
+                      ' End of moon ({0:5.2f}%): {1}\\n'.format(
+                          v.end_moon.moon_frac*100,
+                          v.end_moon.strftime(local))]
+        lines.append('END:VEVENT')
+        self.write('\r\n'.join(lines) + '\r\n')
+
+    def end(self):
+        self.write('END:VCALENDAR\r\n')
+        super().end()
+
+class wiki_writer(schedule_writer):
+    """HTML wiki table output."""
+    def begin(self):
+        self.write('<HTML>\n'
+                   '<HEAD><TITLE>VERITAS Observation Times</TITLE></HEAD>\n'
+                   '<BODY>\n'
+                   '<TABLE border="1">\n'
+                   '<TR>\n'
+                   '  <TH>DR</TH>\n'
+                   '  <TH>Day of DR</TH>\n'
+                   '  <TH>Night Beginning</TH>\n'
+                   '  <TH>Obs Begin</TH>\n'
+                   '  <TH>Obs End</TH>\n'
+                   '</TR>\n')
+
+    def night(self, v, night_type, run_number, run_night_number):
+        self.write('<TR>\n'
+                   f'  <TD>{run_number}</TD>\n'
+                   f'  <TD>{run_night_number}</TD>\n'
+                   f'  <TD>{v.sunset.strftime("%Y-%b-%d")}</TD>\n'
+                   f'  <TD>{v.start_night.strftime("%Y-%b-%d %H:%M")}</TD>\n'
+                   f'  <TD>{v.end_night.strftime("%Y-%b-%d %H:%M")}</TD>\n'
+                   '</TR>\n')
+
+    def end(self):
+        self.write('</TABLE>\n'
+                   '</BODY>\n'
+                   '</HTML>\n')
+        super().end()
+
+def number_list(string):
+    """argparse type for a comma separated list of numbers"""
+    try:
+        return [float(s) for s in string.split(',')]
+    except ValueError:
+        raise argparse.ArgumentTypeError(
+            f'not a comma separated list of numbers: {string!r}')
+
+# event order of the columns used by classify_nights, and moon_or_rhv codes
+SUNSET, SUNRISE, MOONSET, MOONRISE = range(4)
+NO_MOON, MOON, RHV = range(3)
+microsecond = datetime.timedelta(microseconds=1)
+
+def event_columns(events):
+    """Columns for classify_nights from a list of (sunset, sunrise, moonset,
+    moonrise) event tuples. Times are integer microseconds since the unix
+    epoch, so they compare exactly as the event datetimes do."""
+    times = tuple(np.array([(night[i].dt - unix_epoch)//microsecond
+                            for night in events], dtype=np.int64)
+                  for i in range(4))
+    fracs = tuple(np.array([night[i].moon_frac for night in events])
+                  for i in range(4))
+    sunrise_alt = np.array([night[SUNRISE].moon_alt for night in events])
+    return times, fracs, sunrise_alt
+
+def classify_nights(times, fracs, sunrise_alt, moon_phase, rhv_phase,
+                    interval):
+    """Columnar version of vephem find_events, find_night, find_dark, and
+    find_moon for all nights at once. times and fracs are (sunset, sunrise,
+    moonset, moonrise) tuples of arrays from event_columns, interval is a
+    timedelta. Returns a dict of arrays, one entry per night:
+    start_night, end_night, start_dark, end_dark, start_moon, and end_moon
+    hold the event (SUNSET ... MOONRISE) vephem picks, or -1 where vephem
+    has None; night_duration, dark_duration, and moon_duration are in
+    microseconds; moon_or_rhv is NO_MOON, MOON, or RHV. vephem is the
+    reference, results are identical to it."""
+    ss, sr, ms, mr = times
+    f_ss, f_sr, f_ms, f_mr = fracs
+    interval = interval//microsecond
+
+    def time_of(e):
+        return np.where(e == SUNSET, ss, np.where(e == SUNRISE, sr,
+                        np.where(e == MOONSET, ms, mr)))
+
+    def duration(start, end):
+        return np.where((start >= 0) & (end >= 0),
+                        time_of(end) - time_of(start), 0)
+
+    def phase(frac):
+        return np.where(frac < moon_phase, MOON,
+                        np.where(frac < rhv_phase, RHV, NO_MOON))
+
+    # find_events: the moon event is the one right after sunset in the
+    # sorted event list. sorted() is stable, so equal times keep the
+    # sunset, sunrise, moonset, moonrise order.
+    key = [t*4 + i for i, t in enumerate(times)]
+    def after_sunset(e):
+        return key[e] > key[SUNSET]
+    rise_first = after_sunset(MOONRISE) & \
+        (~after_sunset(SUNRISE) | (key[MOONRISE] < key[SUNRISE])) & \
+        (~after_sunset(MOONSET) | (key[MOONRISE] < key[MOONSET]))
+
+    # the cases of the vephem if/elif chains, in order
+    up_all_night = (mr < ss) & (ms > sr)
+    down_all_night = (ms < ss) & (mr > sr) & ~up_all_night
+    both_before = (ms < ss) & (mr < ss) & ~up_all_night & ~down_all_night
+    both_after = (ms > sr) & (mr > sr) & ~up_all_night & ~down_all_night & \
+        ~both_before
+    during = ~(up_all_night | down_all_night | both_before | both_after)
+    rising = during & rise_first
+    setting = during & ~rise_first
+
+    # find_night
+    start_night = np.where(setting & ~(np.maximum(f_ss, f_ms) <= rhv_phase),
+                           MOONSET, SUNSET)
+    end_night = np.where(rising & (np.maximum(f_sr, f_mr) > rhv_phase),
+                         MOONRISE, SUNRISE)
+    night_duration = duration(start_night, end_night)
+    # vephem keeps the short duration when it resets the night
+    short = night_duration < interval
+    start_night = np.where(short, SUNSET, start_night)
+    end_night = np.where(short, SUNRISE, end_night)
+
+    # find_dark
+    whole = down_all_night | ((both_before | both_after) & (sunrise_alt < 0))
+    start_dark = np.where(whole | rising, SUNSET,
+                          np.where(setting, MOONSET, -1))
+    end_dark = np.where(whole | setting, SUNRISE,
+                        np.where(rising, MOONRISE, -1))
+
+    # find_moon
+    up = (both_before | both_after) & (mr > ms)
+    start_moon = np.where(up_all_night | up | setting, SUNSET,
+                          np.where(rising, MOONRISE, -1))
+    end_moon = np.where(up_all_night | up | rising, SUNRISE,
+                        np.where(setting, MOONSET, -1))
+    moon_or_rhv = np.where(up, phase(np.maximum(f_ss, f_sr)),
+                  np.where(rising, phase(np.maximum(f_mr, f_sr)),
+                  np.where(setting, phase(np.maximum(f_ss, f_ms)), NO_MOON)))
+
+    return {'start_night': start_night, 'end_night': end_night,
+            'night_duration': night_duration,
+            'start_dark': start_dark, 'end_dark': end_dark,
+            'dark_duration': duration(start_dark, end_dark),
+            'start_moon': start_moon, 'end_moon': end_moon,
+            'moon_duration': duration(start_moon, end_moon),
+            'moon_or_rhv': moon_or_rhv}
+
+def count_periods(flags):
+    """Number of runs of consecutive True values"""
+    if len(flags) == 0:
+        return 0
+    return int(flags[0]) + int(np.count_nonzero(flags[1:] & ~flags[:-1]))
+
+def print_sweep(nights, moon_phases, rhv_phases, intervals):
+    """Classify the nights for every combination of moon phase, RHV phase,
+    and minimum interval and print a summary line for each. The events of
+    each night are only computed once. Nights are classified with
+    classify_nights when numpy is available and with vephem otherwise."""
+    global max_moon_phase, max_rhv_phase, minimum_interval
+    events = [(v.sunset, v.sunrise, v.moonset, v.moonrise) for v in nights]
+    if np is not None:
+        columns = event_columns(events)
+
+    print('max_moon_phase,max_rhv_phase,minimum_interval,dark_hours,'
+          'moon_hours,rhv_hours,dr_periods,br_periods,dr_nights,br_nights')
+    for max_moon_phase, max_rhv_phase, hours in \
+            itertools.product(moon_phases, rhv_phases, intervals):
+        minimum_interval = datetime.timedelta(hours=hours)
+        if np is not None:
+            c = classify_nights(*columns, max_moon_phase, max_rhv_phase,
+                                minimum_interval)
+            dark = int(c['dark_duration'].sum())
+            moon_time = {key: int(c['moon_duration'][c['moon_or_rhv'] ==
+                                                     code].sum())
+                         for key, code in (('moon', MOON), ('rhv', RHV))}
+            dr = c['dark_duration'] >= minimum_interval//microsecond
+            dr_nights = int(np.count_nonzero(dr))
+            br_nights = len(dr) - dr_nights
+            # a period is a run of consecutive nights of the same type,
+            # as numbered by the schedule output
+            dr_periods = count_periods(dr)
+            br_periods = count_periods(~dr)
+        else:
+            dark = 0
+            moon_time = {'moon': 0, 'rhv': 0}
+            dr_periods = br_periods = dr_nights = br_nights = 0
+            previous = None
+            for e in events:
+                v = vephem(None, e)
+                dark += v.dark_duration//microsecond
+                if v.moon_or_rhv is not None:
+                    moon_time[v.moon_or_rhv] += v.moon_duration//microsecond
+                v.get_night_type()
+                if v.night_type == 'DR':
+                    dr_nights += 1
+                    dr_periods += previous != 'DR'
+                else:
+                    br_nights += 1
+                    br_periods += previous != 'BR'
+                previous = v.night_type
+        print(f'{max_moon_phase},{max_rhv_phase},{hours},'
+              f'{dark/3.6e9:.2f},{moon_time["moon"]/3.6e9:.2f},'
+              f'{moon_time["rhv"]/3.6e9:.2f},'
+              f'{dr_periods},{br_periods},{dr_nights},{br_nights}')
 
+def read_targets(path):
+    """(name, ra, dec) of each target in a catalog file, ra and dec in
+    degrees. Each line is a name followed by ra and dec, separated by
+    commas or white space; '#' starts a comment."""
+    targets = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            fields = line.split('#', 1)[0].replace(',', ' ').split()
+            if not fields:
+                continue
+            try:
+                name, ra, dec = fields[0], float(fields[1]), float(fields[2])
+                if len(fields) != 3 or not -90. <= dec <= 90.:
+                    raise ValueError
+            except (IndexError, ValueError):
+                raise RuntimeError(f'{path}:{n}: expected name, ra, dec')
+            targets.append((name, ra, dec))
+    return targets
 
-parser = argparse.ArgumentParser(description='Generate VERITAS run schedule from data provided by an external ephemeris program that provides sunrise, sunset, moonrise, and moonset times.', epilog='Date format of start_date and stop_date is \'YYYY-MM-DD\' in UT time zone. If neither --dark-run or --bright-run are specified, both are printed out. If --night-program is not provided, the default is \'vnight\'.')
+def datetime_to_jd(dt):
+    return (dt - unix_epoch).total_seconds()/86400. + unix_epoch_jd
+
+def local_sidereal_time(jd):
+    """Local mean sidereal time at VERITAS in degrees, the expression of
+    ln_get_mean_sidereal_time. Nutation is left out, which moves altitudes
+    by well under an arcminute."""
+    t = (jd - 2451545.)/36525.
+    degrees = 280.46061837 + 360.98564736629*(jd - 2451545.) + \
+        t*t*(0.000387933 - t/38710000.) + veritas_longitude
+    return degrees % 360.
+
+def altitude_terms(targets):
+    """Struct-of-arrays form of the catalog for the altitude kernel. With
+    _vnight these are the ra and dec columns for its vectorized C kernel.
+    Otherwise they are the constants of sin(alt) = a + b*cos(lst) +
+    c*sin(lst) for local sidereal time lst, so the kernel needs no trig
+    per target and sample, only over samples."""
+    if _vnight is not None:
+        return (array.array('d', (ra for name, ra, dec in targets)),
+                array.array('d', (dec for name, ra, dec in targets)))
+    lat = math.radians(veritas_latitude)
+    a, b, c = [], [], []
+    for name, ra, dec in targets:
+        ra, dec = math.radians(ra), math.radians(dec)
+        a.append(math.sin(lat)*math.sin(dec))
+        b.append(math.cos(lat)*math.cos(dec)*math.cos(ra))
+        c.append(math.cos(lat)*math.cos(dec)*math.sin(ra))
+    if np is not None:
+        return np.array(a), np.array(b), np.array(c)
+    return a, b, c
+
+def window_samples(start, end, step):
+    """julian dates every step days from start event to end event, and
+    the time in hours each one stands for. The last sample only stands for
+    what is left of the window."""
+    if start is None or end is None:
+        return [], []
+    jd0 = datetime_to_jd(start.dt)
+    jd1 = datetime_to_jd(end.dt)
+    n = max(0, math.ceil((jd1 - jd0)/step))
+    jds = [jd0 + i*step for i in range(n)]
+    return jds, [min(step, jd1 - jd)*24. for jd in jds]
+
+def visible_hours(terms, elevation, jds, weights):
+    """Hours each target is above elevation degrees over the samples"""
+    lst = [local_sidereal_time(jd) for jd in jds]
+    if _vnight is not None:
+        ra, dec = terms
+        return _vnight.time_above(veritas_latitude, ra, dec,
+                                  array.array('d', lst),
+                                  array.array('d', weights), elevation)
+    sin_cut = math.sin(math.radians(elevation))
+    a, b, c = terms
+    lst = [math.radians(x) for x in lst]
+    if np is not None:
+        if not lst:
+            return np.zeros(len(a))
+        lst = np.array(lst)
+        sin_alt = a[:, None] + np.outer(b, np.cos(lst)) + \
+            np.outer(c, np.sin(lst))
+        return (sin_alt > sin_cut) @ np.array(weights)
+    cos_lst = [math.cos(x) for x in lst]
+    sin_lst = [math.sin(x) for x in lst]
+    return [sum(w for w, cl, sl in zip(weights, cos_lst, sin_lst)
+                if at + bt*cl + ct*sl > sin_cut)
+            for at, bt, ct in zip(a, b, c)]
+
+def print_visibility(nights, targets, elevation, step):
+    """Print the hours each target is above elevation degrees in the
+    dark, moon, and RHV windows of each night, as found by vephem, one
+    line per night and target. Altitudes are sampled every step
+    minutes."""
+    terms = altitude_terms(targets)
+    step /= 1440.
+    print('utc_date,target,dark_hours,moon_hours,rhv_hours')
+    for v in nights:
+        dark = visible_hours(terms, elevation,
+                             *window_samples(v.start_dark, v.end_dark, step))
+        moon = visible_hours(terms, elevation,
+                             *window_samples(v.start_moon, v.end_moon, step)
+                             if v.moon_or_rhv is not None else ([], []))
+        date = v.sunset.dt.astimezone(ZoneInfo('UTC')).strftime('%Y-%m-%d')
+        for i, (name, ra, dec) in enumerate(targets):
+            moon_hours = moon[i] if v.moon_or_rhv == 'moon' else 0.
+            rhv_hours = moon[i] if v.moon_or_rhv == 'rhv' else 0.
+            print(f'{date},{name},{dark[i]:.2f},{moon_hours:.2f},'
+                  f'{rhv_hours:.2f}')
+
+class forecast_period:
+    """Dark, moon, and RHV hours and night counts of the nights of a month
+    or season, as the schedule classifies them"""
+    def __init__(self, name, first):
+        self.name = name
+        self.first = first
+        self.last = first
+        self.nights = self.dr_nights = 0
+        self.dark = self.moon = self.rhv = 0
+
+    def add(self, date, v):
+        self.last = date
+        self.nights += 1
+        self.dr_nights += v.dark_duration >= minimum_interval
+        self.dark += v.dark_duration//microsecond
+        if v.moon_or_rhv == 'moon':
+            self.moon += v.moon_duration//microsecond
+        elif v.moon_or_rhv == 'rhv':
+            self.rhv += v.moon_duration//microsecond
+
+    def row(self):
+        return (f'{self.name},{self.first.isoformat()},'
+                f'{self.last.isoformat()},{self.nights},{self.dr_nights},'
+                f'{self.nights - self.dr_nights},{self.dark/3.6e9:.2f},'
+                f'{self.moon/3.6e9:.2f},{self.rhv/3.6e9:.2f}')
+
+def season_name(date, start_month):
+    """YYYY-YYYY season of the UT date, seasons starting on the first of
+    start_month"""
+    year = date.year if date.month >= start_month else date.year - 1
+    return f'{year}-{year + 1}' if start_month > 1 else f'{year}'
+
+def print_forecast(nights, start_month):
+    """Print the dark, moon, and RHV hours and the DR and BR nights of each
+    month of the date range, and of each season after its last month,
+    then of the whole range. The nights are summed as they arrive and
+    none are kept, and every night source hands them over in pieces of a
+    bounded size, so a forecast of any length takes the same memory."""
+    print('period,first_date,last_date,nights,dr_nights,br_nights,'
+          'dark_hours,moon_hours,rhv_hours')
+    month = season = None
+    total = forecast_period('total', dtstart_date)
+    date = dtstart_date
+    for v in nights:
+        if month is None or date.month != month.first.month:
+            if month is not None:
+                print(month.row())
+            month = forecast_period(date.strftime('%Y-%m'), date)
+        name = season_name(date, start_month)
+        if season is None or name != season.name:
+            if season is not None:
+                print(season.row())
+            season = forecast_period(name, date)
+        for period in (month, season, total):
+            period.add(date, v)
+        date += datetime.timedelta(days=1)
+    for period in (month, season):
+        if period is not None:
+            print(period.row())
+    print(total.row())
+
+parser = argparse.ArgumentParser(description='Generate VERITAS run schedule from data provided by an external ephemeris program that provides sunrise, sunset, moonrise, and moonset times.', epilog='Date format of start_date and stop_date is \'YYYY-MM-DD\' in UT time zone. If neither --dark-run or --bright-run are specified, both are printed out. If --night-program is not provided, the _vnight module is used if available, otherwise the default is \'vnight\'.')
 parser.add_argument('start_date', help='First night in range of nights to generate ephmeris. Format is YYYY-MM-DD. Use UT date; times are printed in local.')
 parser.add_argument('stop_date', help='Last night in range of nights to generate ephmeris. Format is YYYY-MM-DD. Use UT date; times are printed in local')
-parser.add_argument('--night-program','-n', default='vnight',
-                    help='Executable that outputs night event times. Default is \'vnight\' and needs to be in your path.')
+parser.add_argument('--night-program','-n', default=None,
+                    help='Executable that outputs night event times. It is run once with --start/--stop for the whole date range. If not given, the compiled _vnight module is used when it can be imported, otherwise \'vnight\', which needs to be in your path.')
 parser.add_argument('-v', '--verbose', action='count', default=0,
                     help='Use mutliple times for more verbose output.')
 parser.add_argument('--bright-run','-b', dest='run_mode_type',
@@ -506,7 +1079,41 @@ parser.add_argument('--max-rhv-phase', dest='max_rhv_phase', type=float,
 parser.add_argument('--minimum-interval', '-m', dest='minimum_interval',
                     type=float, default=default_minimum_interval,
                     help='Minimum hours of dark time to be a dark run night (default: %(default)s)')
+parser.add_argument('--sweep-moon-phase', type=number_list,
+                    help='Comma separated max moon phases to sweep. Any --sweep option prints a summary of dark, moon, and RHV hours and DR/BR periods for every combination of the swept values instead of the schedule; options not swept keep their single value.')
+parser.add_argument('--sweep-rhv-phase', type=number_list,
+                    help='Comma separated max RHV phases to sweep.')
+parser.add_argument('--sweep-interval', type=number_list,
+                    help='Comma separated minimum intervals (hours) to sweep.')
+parser.add_argument('--targets',
+                    help='Catalog of targets, one "name ra dec" line each (degrees). Prints the hours each target is above --elevation in the dark, moon, and RHV windows of every night instead of the schedule.')
+parser.add_argument('--elevation', type=float, default=30.,
+                    help='Elevation cut in degrees for --targets (default: %(default)s)')
+parser.add_argument('--visibility-step', type=float, default=5.,
+                    help='Minutes between target altitude samples for --targets (default: %(default)s)')
+parser.add_argument('--forecast', action='store_true',
+                    help='Print the dark, moon, and RHV hours and the DR and BR nights of each month, each season, and the whole date range instead of the schedule.')
+parser.add_argument('--season-start', type=int, default=9, metavar='MONTH',
+                    help='Month the seasons of --forecast start in (default 9, September).')
 parser.add_argument('--output', '-o', help='File to write output')
+parser.add_argument('--jobs', '-j', type=int, default=1,
+                    help='Split the date range into pieces and run up to this many night programs on them at once. The nights are still scheduled in date order, so the output is the same. Tables and caches are instead built by one night program with this many --jobs.')
+parser.add_argument('--binary', action='store_true',
+                    help='Read nights from the --binary output of the night program as they are computed, instead of its CSV output.')
+parser.add_argument('--window', '-w', action='store_true',
+                    help='Read nights from the --window output of the night program, which has every moon rise and set between sunset and sunrise, so that nights with none or with both are scheduled from their own events.')
+parser.add_argument('--roots', '-x', action='store_true',
+                    help='Have the night program, or the _vnight module, find the events as exact horizon crossings (vnight --roots) instead of with libnova\'s rise/set method.')
+parser.add_argument('--table', '-t',
+                    help='Read nights from this vnight binary night table. The night program writes it first if it is missing, stale, or does not cover the date range.')
+parser.add_argument('--cache', '-C',
+                    help='Read nights from the vnight per-year night tables in this directory. The night program computes and adds the nights that are not there yet.')
+parser.add_argument('--server',
+                    help='Ask the vnight --serve server listening on this unix socket for the nights instead of running the night program.')
+parser.add_argument('--run-index',
+                    help='Index of the DR and BR periods of the season from start_date to stop_date. It is written from the nights first if it is missing or was made for another season or minimum interval.')
+parser.add_argument('--run-lookup', action='append', metavar='DATE',
+                    help='Print the run period and night of the UT date DATE, YYYY-MM-DD, from the run index instead of the schedule. May be repeated.')
 parser.add_argument('--ical',
                     help='Generate iCal output suitable for use with Google Calendar.',
                     dest='output_type',
@@ -515,6 +1122,45 @@ parser.add_argument('--wiki', help='Generate HTML wiki table output',
                     dest='output_type', action='store_const', const='wiki')
 args = parser.parse_args()
 
+sweep = args.sweep_moon_phase is not None or \
+    args.sweep_rhv_phase is not None or args.sweep_interval is not None
+if sweep and args.output_type is not None:
+    parser.error('--sweep options cannot be combined with --ical or --wiki')
+if args.targets is not None and (sweep or args.output_type is not None):
+    parser.error('--targets cannot be combined with --sweep options, --ical, '
+                 'or --wiki')
+if args.forecast and (sweep or args.targets is not None or
+                      args.output_type is not None or
+                      args.run_lookup is not None):
+    parser.error('--forecast cannot be combined with --sweep options, '
+                 '--targets, --ical, --wiki, or --run-lookup')
+if not 1 <= args.season_start <= 12:
+    parser.error('--season-start must be a month, 1 to 12')
+if args.table is not None and args.cache is not None:
+    parser.error('--table cannot be combined with --cache')
+if args.jobs < 1:
+    parser.error('--jobs must be at least 1')
+if args.jobs > 1 and args.server is not None:
+    parser.error('--jobs cannot be combined with --server')
+if args.server is not None and (args.table is not None or
+                                args.cache is not None or args.window or
+                                args.binary):
+    parser.error('--server cannot be combined with --table, --cache, '
+                 '--window, or --binary')
+# a night table does not record the solver it was written with
+if args.roots and (args.server is not None or args.table is not None):
+    parser.error('--roots cannot be combined with --server or --table')
+if args.window and (args.table is not None or args.cache is not None or
+                    args.binary or sweep):
+    parser.error('--window cannot be combined with --table, --cache, '
+                 '--binary, or --sweep options')
+if args.run_lookup is not None and (sweep or args.targets is not None or
+                                    args.output_type is not None):
+    parser.error('--run-lookup cannot be combined with --sweep options, '
+                 '--targets, --ical, or --wiki')
+if args.visibility_step <= 0.:
+    parser.error('--visibility-step must be positive')
+
 minimum_interval = datetime.timedelta(hours=args.minimum_interval)
 max_moon_phase = args.max_moon_phase
 max_rhv_phase = args.max_rhv_phase
@@ -552,41 +1198,511 @@ if args.output is not None:
     sys.stdout = open(args.output, 'w')
 
 if args.output_type == 'ical':
-    print('BEGIN:VCALENDAR\r', file=args.output)
-    print('VERSION:2.0\r')
-    print('PRODID:-//VERITAS/Observing Calendar 2.0//EN\r')
+    writer = ical_writer(sys.stdout, season_tag)
 elif args.output_type == 'wiki':
-    print('<HTML>')
-    print('<HEAD><TITLE>VERITAS Observation Times</TITLE></HEAD>')
-    print('<BODY>')
-    print('<TABLE border="1">')
-    print('<TR>')
-    print('  <TH>DR</TH>')
-    print('  <TH>Day of DR</TH>')
-    print('  <TH>Night Beginning</TH>')
-    print('  <TH>Obs Begin</TH>')
-    print('  <TH>Obs End</TH>')
-    print('</TR>')
-
-scheduler = args.night_program
-dcounter = dtstart_date
-while dcounter <= dtstop_date:
-    #print('dcounter:', dcounter)
-    callArgs = [scheduler]
-    # have vnight program output csv format, local times, and include time zone
-    # information for each time it outputs
-    callArgs.append('-clz')
-    callArgs.append(str(dcounter.year))
-    callArgs.append(str(dcounter.month))
-    callArgs.append(str(dcounter.day))
+    writer = wiki_writer(sys.stdout)
+else:
+    writer = csv_writer(sys.stdout)
+# verbose output is printed as the nights are read, so each night has to
+# be out before the next one is read
+if args.verbose:
+    writer.chunk_size = 0
+writer.begin()
+
+# smallest piece of the date range given to a night program with --jobs,
+# so that starting the program stays cheap next to computing the nights,
+# and largest, so that the output held for the pieces in flight does not
+# grow with the range
+min_piece_nights = 32
+max_piece_nights = 1024
+# nights asked of the _vnight module at a time
+module_chunk_nights = 366
+# nights read from a server reply at a time
+server_chunk_nights = 1024
+
+def range_chunks(size):
+    """(start, stop) dates of consecutive pieces of the date range of size
+    nights, the last one possibly shorter, in date order"""
+    count = (dtstop_date - dtstart_date).days + 1
+    for first in range(0, count, size):
+        yield (dtstart_date + datetime.timedelta(days=first),
+               dtstart_date + datetime.timedelta(
+                   days=min(first + size, count) - 1))
+
+def range_pieces():
+    """(start, stop) dates of the pieces the date range is split into for
+    --jobs, in date order. there are a few pieces per job so that a slow
+    piece does not leave the other jobs idle at the end."""
+    count = (dtstop_date - dtstart_date).days + 1
+    return range_chunks(min(max_piece_nights,
+                            max(min_piece_nights, -(-count//(4*args.jobs)))))
+
+def piece_output(call_args, text):
+    """stdout of a night program run over one piece of the date range"""
+    if args.verbose > 1:
+        print('subprocess callArgs:', call_args)
+    return subprocess.run(call_args, text=text, capture_output=True,
+                          check=True).stdout
+
+def program_pieces(call_args, text=True):
+    """(start, stop, stdout) of the night program run by call_args(start,
+    stop) over pieces of the date range, in date order. up to --jobs
+    programs run at once, each waited on by a thread of its own. a piece
+    that finishes before the ones ahead of it waits in the reorder buffer,
+    which holds no more than 2*jobs pieces, running or done."""
+    pieces = range_pieces()
+    with ThreadPoolExecutor(args.jobs) as pool:
+        window = collections.deque()
+        def submit(start, stop):
+            window.append((start, stop, pool.submit(
+                piece_output, call_args(start, stop), text)))
+        for start, stop in itertools.islice(pieces, 2*args.jobs):
+            submit(start, stop)
+        while window:
+            start, stop, future = window.popleft()
+            output = future.result()
+            for next_start, next_stop in itertools.islice(pieces, 1):
+                submit(next_start, next_stop)
+            yield start, stop, output
+
+def roots_args():
+    """night program options for the solver chosen with --roots"""
+    return ('--roots',) if args.roots else ()
+
+def program_lines(lines, count, night):
+    """night built from each of the first count lines of night program
+    output, returning the number of lines there were"""
+    returned = 0
+    for line in lines:
+        returned += 1
+        if returned <= count:
+            line = line.rstrip('\n')
+            if args.verbose:
+                print('subprocess output:')
+                print(line)
+            yield night(line)
+    return returned
+
+def check_returned(scheduler, returned, start, stop):
+    """exit unless the night program returned a night for each date from
+    start to stop"""
+    if returned != (stop - start).days + 1:
+        print(f'{scheduler} returned {returned} nights for range '
+              f'{start.isoformat()} to {stop.isoformat()}.',
+              file=sys.stderr)
+        sys.exit(1)
+
+def vnight_program_nights(scheduler, extra=(), night=vephem):
+    """Run the night program for the date range and return a vephem for
+    each night in date order, night built from each line as it arrives on
+    the pipe. the whole range is computed by a single vnight process
+    unless --jobs splits it."""
+    # have vnight program output csv format, local times, and include time
+    # zone information for each time it outputs, one csv line per night.
+    def call_args(start, stop):
+        return [scheduler, '-clz', *roots_args(), *extra,
+                '--start', start.isoformat(),
+                '--stop', stop.isoformat()]
+    if args.jobs > 1:
+        for start, stop, output in program_pieces(call_args):
+            returned = yield from program_lines(
+                output.splitlines(), (stop - start).days + 1, night)
+            check_returned(scheduler, returned, start, stop)
+        return
+    callArgs = call_args(dtstart_date, dtstop_date)
+    if args.verbose > 1:
+        print('subprocess callArgs:', callArgs)
+    with subprocess.Popen(callArgs, stdout=subprocess.PIPE,
+                          text=True) as proc:
+        returned = yield from program_lines(
+            proc.stdout, (dtstop_date - dtstart_date).days + 1, night)
+    if proc.returncode != 0:
+        raise subprocess.CalledProcessError(proc.returncode, callArgs)
+    check_returned(scheduler, returned, dtstart_date, dtstop_date)
+
+def vephem_from_values(values, source):
+    """Build a vephem from the jd, illumination, and altitude of sunset,
+    sunrise, moonset, and moonrise, the same order as the vnight csv."""
+    labels = ('sunset', 'sunrise', 'moonset', 'moonrise')
+    # illumination and altitude are rounded the same way as the vnight
+    # csv output so that every path classifies nights identically
+    events = tuple(event(jd_to_datetime(values[3*i]),
+                         round(values[3*i + 1], 4), round(values[3*i + 2], 4),
+                         label)
+                   for i, label in enumerate(labels))
+    if args.verbose:
+        print(f'{source} output:')
+        print(', '.join(str(e) for e in events))
+    return vephem(None, events)
+
+def vnight_module_nights():
+    """Compute the date range in-process with the _vnight module and return
+    a vephem for each night in date order. the module is asked for
+    module_chunk_nights at a time so that its columns stay small."""
+    for start, stop in range_chunks(module_chunk_nights):
+        cols = _vnight.nights(start.isoformat(), stop.isoformat(),
+                              roots=args.roots)
+        columns = []
+        for p in ('sun_set', 'sun_rise', 'moon_set', 'moon_rise'):
+            columns += [cols[p + '_jd'], cols[p + '_illum'], cols[p + '_alt']]
+        first = (start - dtstart_date).days
+        for i in range(len(cols['status'])):
+            if cols['status'][i] != _vnight.OK:
+                print(f'Warning: night {first + i} of range has status '
+                      f'{cols["status"][i]}', file=sys.stderr)
+            yield vephem_from_values([c[i] for c in columns], '_vnight')
+
+def binary_nights(scheduler, read, start, stop, close=None):
+    """vephem of each night of the --binary output of the night program for
+    start to stop, read(n) returning its next n bytes. close is called
+    before exiting on output that is not a night table."""
+    count = (stop - start).days + 1
+    header = parse_table_header(read(table_header.size))
+    if header is None or header[0] != start or header[1] != count:
+        if close is not None:
+            close()
+        print(f'{scheduler} did not write a night table for range '
+              f'{start.isoformat()} to {stop.isoformat()}.', file=sys.stderr)
+        sys.exit(1)
+    for i in range(count):
+        data = read(table_record.size)
+        if len(data) != table_record.size:
+            print(f'{scheduler} returned {i} nights for range '
+                  f'{start.isoformat()} to {stop.isoformat()}.',
+                  file=sys.stderr)
+            sys.exit(1)
+        record = table_record.unpack(data)
+        if record[12] != 0:
+            print(f'Warning: night {(start - dtstart_date).days + i} of '
+                  f'range has status {record[12]}', file=sys.stderr)
+        yield vephem_from_values(record, scheduler)
+
+def vnight_binary_nights(scheduler, extra=(), pieces=True):
+    """Run the night program for the date range with --binary and return a
+    vephem for each night in date order, as the records arrive on the pipe.
+    with --jobs, and pieces, the range is split between programs as by
+    vnight_program_nights."""
+    def call_args(start, stop):
+        return [scheduler, '--binary', *roots_args(), *extra,
+                '--start', start.isoformat(),
+                '--stop', stop.isoformat()]
+    if args.jobs > 1 and pieces:
+        for start, stop, output in program_pieces(call_args, text=False):
+            yield from binary_nights(scheduler, io.BytesIO(output).read,
+                                     start, stop)
+        return
+    callArgs = call_args(dtstart_date, dtstop_date)
+    if args.verbose > 1:
+        print('subprocess callArgs:', callArgs)
+    with subprocess.Popen(callArgs, stdout=subprocess.PIPE) as proc:
+        yield from binary_nights(scheduler, proc.stdout.read, dtstart_date,
+                                 dtstop_date, proc.kill)
+    if proc.returncode != 0:
+        raise subprocess.CalledProcessError(proc.returncode, callArgs)
+
+def parse_table_header(data):
+    """(first date, number of nights) of a vnight binary night table
+    header, or None if data is not a header made for this site and
+    twilight angles"""
+    if len(data) < table_header.size:
+        return None
+    (magic, header_size, record_size, nights, _, start_mjd, latitude,
+     longitude, begin, end) = table_header.unpack_from(data)
+    if magic != table_magic or header_size != table_header.size or \
+            record_size != table_record.size or nights < 0 or \
+            (latitude, longitude, begin, end) != (veritas_latitude,
+                veritas_longitude, horizon_angle_begin, horizon_angle_end):
+        return None
+    return (mjd_epoch + datetime.timedelta(days=start_mjd), nights)
+
+def map_night_table(path):
+    """Map a vnight binary night table. Returns (first date, number of
+    nights, mmap), or None if the file is missing, malformed, or was made
+    for another site or twilight angles."""
+    try:
+        with open(path, 'rb') as f:
+            mm = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    except (OSError, ValueError):
+        return None
+    header = parse_table_header(mm)
+    if header is None or \
+            len(mm) < table_header.size + header[1]*table_record.size:
+        mm.close()
+        return None
+    return header + (mm,)
+
+def jobs_args():
+    """night program options to compute a table with --jobs processes"""
+    return ('--jobs', str(args.jobs)) if args.jobs > 1 else ()
+
+def vnight_table_nights(path, scheduler):
+    """Read the date range from the night table in path, first having the
+    night program (re)write it when it is missing, stale, or does not cover
+    the range, and return a vephem for each night in date order."""
+    table = map_night_table(path)
+    if table is not None:
+        first, count, mm = table
+        if first > dtstart_date or \
+                first + datetime.timedelta(days=count - 1) < dtstop_date:
+            mm.close()
+            table = None
+    if table is None:
+        callArgs = [scheduler, '--start', dtstart_date.isoformat(),
+                    '--stop', dtstop_date.isoformat(), '--table', path,
+                    *jobs_args()]
+        if args.verbose > 1:
+            print('subprocess callArgs:', callArgs)
+        subprocess.run(callArgs, check=True)
+        table = map_night_table(path)
+        if table is None:
+            print(f'{scheduler} did not write a usable table {path}.',
+                  file=sys.stderr)
+            sys.exit(1)
+    first, count, mm = table
+    offset = table_header.size + \
+        (dtstart_date - first).days*table_record.size
+    for i in range((dtstop_date - dtstart_date).days + 1):
+        record = table_record.unpack_from(mm, offset + i*table_record.size)
+        if record[12] != 0:
+            print(f'Warning: night {i} of range has status {record[12]}',
+                  file=sys.stderr)
+        yield vephem_from_values(record, 'table')
+    mm.close()
+
+def cache_key(scheduler):
+    """name of the directory of the night program's cache tables"""
+    callArgs = [scheduler, '--cache-key', *roots_args()]
     if args.verbose > 1:
         print('subprocess callArgs:', callArgs)
-    proc = subprocess.run(callArgs, text=True, capture_output=True,
-                          check=True)
-    v = vephem(proc.stdout)
+    return subprocess.run(callArgs, text=True, capture_output=True,
+                          check=True).stdout.strip()
+
+def cache_tables(cache, scheduler):
+    """(first date, number of nights, mmap) of the cache table of each
+    year of the date range, or None if any night of the range is not in
+    the cache yet."""
+    key = cache_key(scheduler)
+    tables = []
+    for year in range(dtstart_date.year, dtstop_date.year + 1):
+        table = map_night_table(os.path.join(cache, key, f'{year:04d}.vnt'))
+        if table is not None:
+            tables.append(table)
+            first, count, mm = table
+            start = max(dtstart_date, first)
+            stop = min(dtstop_date,
+                       first + datetime.timedelta(days=count - 1))
+            offset = table_header.size + (start - first).days*table_record.size
+            if first.year == year and start <= stop and all(
+                    table_record.unpack_from(mm, offset +
+                            i*table_record.size)[12] != status_not_cached
+                    for i in range((stop - start).days + 1)):
+                continue
+        for _, _, mm in tables:
+            mm.close()
+        return None
+    return tables
+
+def vnight_cache_nights(cache, scheduler):
+    """Read the date range from the night tables in cache when they have
+    all of it. Otherwise the night program fills them in and its --binary
+    output is read instead. Returns a vephem for each night in date
+    order."""
+    tables = cache_tables(cache, scheduler)
+    if tables is None:
+        # night programs on pieces of the range would all write the same
+        # year tables, so the one program splits the nights itself
+        yield from vnight_binary_nights(scheduler,
+                                        ('--cache', cache, *jobs_args()),
+                                        pieces=False)
+        return
+    i = 0
+    for first, count, mm in tables:
+        start = max(dtstart_date, first)
+        stop = min(dtstop_date, first + datetime.timedelta(days=count - 1))
+        offset = table_header.size + (start - first).days*table_record.size
+        for j in range((stop - start).days + 1):
+            record = table_record.unpack_from(mm,
+                                              offset + j*table_record.size)
+            if record[12] != 0:
+                print(f'Warning: night {i} of range has status {record[12]}',
+                      file=sys.stderr)
+            yield vephem_from_values(record, 'cache')
+            i += 1
+        mm.close()
+
+def receive_all(sock, n):
+    """Exactly n bytes from sock"""
+    data = bytearray()
+    while len(data) < n:
+        chunk = sock.recv(min(n - len(data), 1 << 20))
+        if not chunk:
+            raise RuntimeError('server closed the connection')
+        data += chunk
+    return data
+
+def vnight_server_nights(path):
+    """Ask the vnight server at path for the date range in one request and
+    return a vephem for each night in date order. the reply is read
+    server_chunk_nights records at a time."""
+    start_mjd = (dtstart_date - mjd_epoch).days
+    count = (dtstop_date - dtstart_date).days + 1
+    i = 0
+    try:
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.connect(path)
+            sock.sendall(request_header.pack(request_magic, 1) +
+                         server_query.pack(start_mjd, count, 0))
+            magic, status, records, _ = reply_header.unpack(
+                receive_all(sock, reply_header.size))
+            if magic != reply_magic or status != 0 or records != count:
+                raise RuntimeError(f'bad reply, status {status}')
+            while i < records:
+                data = receive_all(sock, min(server_chunk_nights,
+                                             records - i)*table_record.size)
+                for record in table_record.iter_unpack(data):
+                    if record[12] != 0:
+                        print(f'Warning: night {i} of range has status '
+                              f'{record[12]}', file=sys.stderr)
+                    yield vephem_from_values(record, 'server')
+                    i += 1
+    except (OSError, RuntimeError) as e:
+        print(f'Could not query server {path}: {e}', file=sys.stderr)
+        sys.exit(1)
+
+if args.server is not None:
+    nights = vnight_server_nights(args.server)
+elif args.window:
+    nights = vnight_program_nights(args.night_program or 'vnight',
+                                   ('--window',), window_vephem)
+elif args.table is not None:
+    nights = vnight_table_nights(args.table, args.night_program or 'vnight')
+elif args.cache is not None:
+    nights = vnight_cache_nights(args.cache, args.night_program or 'vnight')
+elif args.binary:
+    nights = vnight_binary_nights(args.night_program or 'vnight')
+elif args.night_program is None and _vnight is not None and args.jobs == 1:
+    nights = vnight_module_nights()
+else:
+    nights = vnight_program_nights(args.night_program or 'vnight')
+
+def build_run_index(nights):
+    """List of (first night offset, number of nights, type, run number)
+    of the runs of consecutive DR and BR nights, numbered the way the
+    schedule below numbers them."""
+    periods = []
+    numbers = [0, 0]
+    for i, v in enumerate(nights):
+        kind = 0 if v.dark_duration >= minimum_interval else 1
+        if periods and periods[-1][2] == kind:
+            first, count, _, number = periods[-1]
+            periods[-1] = (first, count + 1, kind, number)
+        else:
+            numbers[kind] += 1
+            periods.append((i, 1, kind, numbers[kind]))
+    return periods
+
+def write_run_index(path, periods):
+    start_mjd = (dtstart_date - mjd_epoch).days
+    with open(path, 'wb') as f:
+        f.write(run_index_header.pack(run_index_magic, run_index_header.size,
+                                      run_index_record.size, len(periods),
+                                      (dtstop_date - dtstart_date).days + 1,
+                                      start_mjd, args.minimum_interval))
+        for p in periods:
+            f.write(run_index_record.pack(*p))
+
+def read_run_index(path):
+    """Periods of the run index in path, or None if it is missing,
+    malformed, or was made for another season or minimum interval."""
+    try:
+        with open(path, 'rb') as f:
+            data = f.read()
+    except OSError:
+        return None
+    if len(data) < run_index_header.size:
+        return None
+    (magic, header_size, record_size, count, nights, start_mjd,
+     interval) = run_index_header.unpack_from(data)
+    if magic != run_index_magic or header_size != run_index_header.size or \
+            record_size != run_index_record.size or count < 0 or \
+            len(data) < header_size + count*record_size or \
+            start_mjd != (dtstart_date - mjd_epoch).days or \
+            nights != (dtstop_date - dtstart_date).days + 1 or \
+            interval != args.minimum_interval:
+        return None
+    return [run_index_record.unpack_from(data, header_size + i*record_size)
+            for i in range(count)]
+
+def lookup_run(periods, firsts, date):
+    """(period, night number in the period) of the UT date, or None if
+    the date is outside the season. firsts is the first night offset of
+    each period, which is binary searched."""
+    offset = (date - dtstart_date).days
+    i = bisect.bisect_right(firsts, offset) - 1
+    if i < 0 or offset >= periods[i][0] + periods[i][1]:
+        return None
+    return periods[i], offset - periods[i][0] + 1
+
+def print_run_lookup(periods, dates):
+    firsts = [p[0] for p in periods]
+    print('utc_date,run,first_night,last_night')
+    for text in dates:
+        try:
+            date = datetime.date.fromisoformat(text)
+        except ValueError:
+            print(f'Invalid date {text}. Accepted format is YYYY-MM-DD.',
+                  file=sys.stderr)
+            sys.exit(1)
+        found = lookup_run(periods, firsts, date)
+        if found is None:
+            print(f'{text} is not in the season {args.start_date} to '
+                  f'{args.stop_date}.', file=sys.stderr)
+            sys.exit(1)
+        (first, count, kind, number), night = found
+        first_date = dtstart_date + datetime.timedelta(days=first)
+        last_date = first_date + datetime.timedelta(days=count - 1)
+        print(f'{date.isoformat()},{run_types[kind]}{number:02d}-'
+              f'{night:02d},{first_date.isoformat()},'
+              f'{last_date.isoformat()}')
+
+if args.run_index is not None or args.run_lookup is not None:
+    periods = None
+    if args.run_index is not None:
+        periods = read_run_index(args.run_index)
+    if periods is None:
+        # the schedule below still needs the nights when nothing is
+        # looked up
+        nights = list(nights)
+        periods = build_run_index(nights)
+        if args.run_index is not None:
+            write_run_index(args.run_index, periods)
+    if args.run_lookup is not None:
+        print_run_lookup(periods, args.run_lookup)
+        nights = ()
+
+if sweep:
+    print_sweep(nights,
+                args.sweep_moon_phase or [args.max_moon_phase],
+                args.sweep_rhv_phase or [args.max_rhv_phase],
+                args.sweep_interval or [args.minimum_interval])
+    # nothing is left for the schedule below to print
+    nights = ()
+elif args.targets is not None:
+    try:
+        targets = read_targets(args.targets)
+    except (OSError, RuntimeError) as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    print_visibility(nights, targets, args.elevation, args.visibility_step)
+    nights = ()
+elif args.forecast:
+    print_forecast(nights, args.season_start)
+    nights = ()
+
+dcounter = dtstart_date
+for v in nights:
+    #print('dcounter:', dcounter)
     if args.verbose:
-        print('subprocess output:')
-        print(proc.stdout)
         print('Events:')
         v.print_events()
         print('Night:')
@@ -602,13 +1718,7 @@ while dcounter <= dtstop_date:
                 dark_run_night_number = 1
             else:
                 dark_run_night_number += 1
-            if args.output_type == 'ical':
-                v.print_ical_event(season_tag, 'DR', dark_run_number,
-                                   dark_run_night_number)
-            elif args.output_type == 'wiki':
-                v.print_wiki_event(dark_run_number, dark_run_night_number)
-            else:
-                v.print_schedule('DR', dark_run_number, dark_run_night_number)
+            writer.night(v, 'DR', dark_run_number, dark_run_night_number)
         else:
             if darkRun == True:
                 dark_run_number += 1
@@ -623,14 +1733,7 @@ while dcounter <= dtstop_date:
                 bright_run_night_number = 1
             else:
                 bright_run_night_number += 1
-            if args.output_type == 'ical':
-                v.print_ical_event(season_tag, 'BR', bright_run_number,
-                                   bright_run_night_number)
-            elif args.output_type == 'wiki':
-                v.print_wiki_event(bright_run_number, bright_run_night_number)
-            else:
-                v.print_schedule('BR', bright_run_number,
-                                 bright_run_night_number)
+            writer.night(v, 'BR', bright_run_number, bright_run_night_number)
         else:
             if brightRun == True:
                 bright_run_number += 1
@@ -641,12 +1744,7 @@ while dcounter <= dtstop_date:
     # advance the date by one day.
     dcounter = dcounter + datetime.timedelta(days=1)
 
-if args.output_type == 'ical':
-    print('END:VCALENDAR\r')
-elif args.output_type == 'wiki':
-    print('</TABLE>')
-    print('</BODY>')
-    print('</HTML>')
+writer.end()
 
 if args.output is not None:
     sys.stdout.close()